@@ -0,0 +1,204 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "frameArena.h"
+#include "particleStore.h"
+#include "spatialOrder.h"
+
+// Long-range attraction with a Barnes-Hut quadtree
+// ------------------------------------------------
+// Every circle pulls every other one with a softened inverse-square force.
+// Summing all pairs would cost O(n^2) per step, so the circles are put in a
+// quadtree and a whole node is replaced by its center of mass whenever it is
+// small compared to its distance (node size / distance < theta). Smaller theta
+// opens more nodes: theta = 0 is the exact sum, 0.5 is the usual compromise.
+//
+// The tree is rebuilt every step from the circles sorted by Morton code: the
+// circles of any quadtree node are then one contiguous run, so a node is just
+// a range and the children of a node are found by splitting its range on the
+// next two bits of the code. The circles share a total mass of 1, so the
+// strength does not depend on how many circles there are. The nodes only live
+// for one step, so they are carved out of a frame arena of the tree's own,
+// which stops allocating once it has grown to the largest tree seen.
+
+const int quadTreeDepth = mortonBits; // levels of the tree, the bits per axis of the Morton code
+const int quadTreeLeafSize = 8;        // nodes with this many circles or fewer are summed directly
+
+struct QuadNode
+{
+    int begin; // range of the node's circles in QuadTree::circles
+    int end;
+    int children[4]; // -1 for an empty quadrant, all -1 for a leaf
+    float size;      // width of the node's square
+    float massX;     // center of mass
+    float massY;
+};
+
+struct QuadTree
+{
+    FrameArena arena;            // holds the nodes, reset by every build
+    ArenaArray<QuadNode> nodes;  // nodes[0] is the root
+    std::vector<int> circles;    // circle indices sorted by Morton code
+    std::vector<uint32_t> codes; // Morton code of each circle
+    std::vector<uint32_t> sortedCodes;
+    std::vector<float> sortedX; // positions in the order of circles, for the leaf sums
+    std::vector<float> sortedY;
+};
+
+// add the node holding circles [begin, end) at depth and its subtree, return its index
+inline int buildQuadNode(QuadTree &tree, int begin, int end, int depth, float size)
+{
+    int index = (int)tree.nodes.size();
+    tree.nodes.push_back(tree.arena, {begin, end, {-1, -1, -1, -1}, size, 0.0f, 0.0f});
+
+    float massX = 0.0f;
+    float massY = 0.0f;
+    if (end - begin <= quadTreeLeafSize || depth == quadTreeDepth)
+    {
+        for (int entry = begin; entry < end; entry++)
+        {
+            massX += tree.sortedX[entry];
+            massY += tree.sortedY[entry];
+        }
+    }
+    else
+    {
+        // within the range the codes are sorted, so each quadrant is a sub-range
+        int shift = 2 * (quadTreeDepth - 1 - depth);
+        int childBegin = begin;
+        for (int quadrant = 0; quadrant < 4; quadrant++)
+        {
+            int childEnd = (int)(std::partition_point(tree.sortedCodes.begin() + childBegin, tree.sortedCodes.begin() + end,
+                                                      [&](uint32_t code) { return int((code >> shift) & 3) <= quadrant; }) -
+                                 tree.sortedCodes.begin());
+            if (childEnd > childBegin)
+            {
+                int child = buildQuadNode(tree, childBegin, childEnd, depth + 1, 0.5f * size);
+                tree.nodes[index].children[quadrant] = child;
+                int count = childEnd - childBegin;
+                massX += tree.nodes[child].massX * count;
+                massY += tree.nodes[child].massY * count;
+            }
+            childBegin = childEnd;
+        }
+    }
+
+    tree.nodes[index].massX = massX / float(end - begin);
+    tree.nodes[index].massY = massY / float(end - begin);
+    return index;
+}
+
+inline void buildQuadTree(QuadTree &tree, const ParticleStore &particles)
+{
+    int numCircles = particles.count;
+    tree.codes.resize(numCircles);
+    tree.circles.resize(numCircles);
+
+#pragma omp parallel for schedule(static)
+    for (int circle = 0; circle < numCircles; circle++)
+    {
+        tree.codes[circle] = positionCode(particles.x[circle], particles.y[circle]);
+        tree.circles[circle] = circle;
+    }
+
+    const std::vector<uint32_t> &codes = tree.codes;
+    std::sort(tree.circles.begin(), tree.circles.end(),
+              [&](int a, int b) { return codes[a] < codes[b] || (codes[a] == codes[b] && a < b); });
+
+    tree.sortedCodes.resize(numCircles);
+    tree.sortedX.resize(numCircles);
+    tree.sortedY.resize(numCircles);
+#pragma omp parallel for schedule(static)
+    for (int entry = 0; entry < numCircles; entry++)
+    {
+        int circle = tree.circles[entry];
+        tree.sortedCodes[entry] = codes[circle];
+        tree.sortedX[entry] = particles.x[circle];
+        tree.sortedY[entry] = particles.y[circle];
+    }
+
+    resetArena(tree.arena, std::max(tree.arena.highWater, tree.arena.stepBytes));
+    tree.nodes.reset();
+    if (numCircles > 0)
+    {
+        buildQuadNode(tree, 0, numCircles, 0, 2.0f);
+    }
+}
+
+// add the pull of every circle on every other one to the speeds; one step of
+// strength * (total mass 1) / distance^2, softened within one radius
+inline void applyAttraction(QuadTree &tree, ParticleStore &particles, float strength, float theta, float radius)
+{
+    buildQuadTree(tree, particles);
+    int numCircles = particles.count;
+    if (numCircles == 0)
+    {
+        return;
+    }
+
+    float pull = strength / float(numCircles); // strength times the mass of one circle
+    float softening = radius * radius;
+    float thetaSquared = theta * theta;
+
+    // walk the circles in tree order, so neighbouring iterations open the same nodes
+#pragma omp parallel for schedule(dynamic, 256)
+    for (int entry = 0; entry < numCircles; entry++)
+    {
+        float x = tree.sortedX[entry];
+        float y = tree.sortedY[entry];
+        float accelerationX = 0.0f;
+        float accelerationY = 0.0f;
+
+        int stack[4 * quadTreeDepth + 4];
+        int stackSize = 0;
+        stack[stackSize++] = 0;
+        while (stackSize > 0)
+        {
+            const QuadNode &node = tree.nodes[stack[--stackSize]];
+            float dx = node.massX - x;
+            float dy = node.massY - y;
+            float distanceSquared = dx * dx + dy * dy;
+            bool leaf = node.children[0] < 0 && node.children[1] < 0 && node.children[2] < 0 && node.children[3] < 0;
+
+            if (!leaf && node.size * node.size < thetaSquared * distanceSquared)
+            {
+                // far enough away to count as one body at its center of mass
+                float inverse = 1.0f / std::sqrt(distanceSquared + softening);
+                float weight = pull * float(node.end - node.begin) * inverse * inverse * inverse;
+                accelerationX += weight * dx;
+                accelerationY += weight * dy;
+            }
+            else if (leaf)
+            {
+                for (int other = node.begin; other < node.end; other++)
+                {
+                    // the circle itself is at distance 0 and adds nothing
+                    float otherX = tree.sortedX[other] - x;
+                    float otherY = tree.sortedY[other] - y;
+                    float inverse = 1.0f / std::sqrt(otherX * otherX + otherY * otherY + softening);
+                    float weight = pull * inverse * inverse * inverse;
+                    accelerationX += weight * otherX;
+                    accelerationY += weight * otherY;
+                }
+            }
+            else
+            {
+                for (int quadrant = 0; quadrant < 4; quadrant++)
+                {
+                    if (node.children[quadrant] >= 0)
+                    {
+                        stack[stackSize++] = node.children[quadrant];
+                    }
+                }
+            }
+        }
+
+        int circle = tree.circles[entry];
+        particles.vx[circle] += accelerationX;
+        particles.vy[circle] += accelerationY;
+    }
+}
@@ -0,0 +1,206 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "options.h"
+#include "simulation.h"
+
+// Microbenchmark of the physics step
+// ----------------------------------
+// Times every phase of the step on its own for circle counts from --min to
+// --max (multiplying by 4), once with a single thread and once with every
+// thread. Built with -fopenmp both rows run the OpenMP engine of
+// parallelVersion.cpp and are labelled "openmp"; built without it there is
+// only the single-threaded row, the serial engine of hello_Circle.cpp. Each
+// phase is run --warmup times untimed,
+// then --reps times timed, and one CSV line per phase reports the median and
+// 95th percentile.
+//
+// The radius shrinks with the circle count so the circles always cover the
+// same fraction of the screen; with the fixed radius of the demo 1M circles
+// would all overlap each other.
+
+struct BenchmarkSettings
+{
+    int minCircles = 1000;
+    int maxCircles = 1000000;
+    int warmup = 3;
+    int repetitions = 15;
+    float areaFraction = 0.2f; // screen area covered by circles
+    int maxBruteForce = 20000; // larger counts skip the all-pairs phase
+    float attraction = 1e-6f;  // strength of the attraction phase, a visible pull at the demo speeds
+};
+
+void printBenchmarkUsage(const char *program)
+{
+    std::cout << "Usage: " << program << " [options]\n"
+              << "  --min N          smallest circle count (default: 1000)\n"
+              << "  --max N          largest circle count (default: 1000000)\n"
+              << "  --warmup N       untimed runs per phase (default: 3)\n"
+              << "  --reps N         timed runs per phase (default: 15)\n"
+              << "  --fraction F     screen area covered by circles (default: 0.2)\n"
+              << "  --max-brute N    largest count timed with all pairs (default: 20000)\n"
+              << "  --attraction G   strength of the timed attraction (default: 1e-6)" << std::endl;
+}
+
+bool parseBenchmarkOptions(int argc, char **argv, BenchmarkSettings &settings)
+{
+    for (int arg = 1; arg < argc; arg++)
+    {
+        const char *value = arg + 1 < argc ? argv[arg + 1] : NULL;
+        bool valid = false;
+
+        if (strcmp(argv[arg], "--min") == 0)
+            valid = parsePositive(value, settings.minCircles);
+        else if (strcmp(argv[arg], "--max") == 0)
+            valid = parsePositive(value, settings.maxCircles);
+        else if (strcmp(argv[arg], "--warmup") == 0)
+            valid = parsePositive(value, settings.warmup);
+        else if (strcmp(argv[arg], "--reps") == 0)
+            valid = parsePositive(value, settings.repetitions);
+        else if (strcmp(argv[arg], "--max-brute") == 0)
+            valid = parsePositive(value, settings.maxBruteForce);
+        else if (strcmp(argv[arg], "--fraction") == 0 && value != NULL)
+        {
+            settings.areaFraction = (float)atof(value);
+            valid = settings.areaFraction > 0.0f && settings.areaFraction < 1.0f;
+        }
+        else if (strcmp(argv[arg], "--attraction") == 0 && value != NULL)
+        {
+            settings.attraction = (float)atof(value);
+            valid = settings.attraction > 0.0f;
+        }
+
+        if (!valid)
+        {
+            printBenchmarkUsage(argv[0]);
+            return false;
+        }
+        arg++;
+    }
+    return true;
+}
+
+// run phase warmup times, then return the duration of each of the timed runs in ns
+template <typename Phase>
+std::vector<double> timePhase(const BenchmarkSettings &settings, Phase phase)
+{
+    for (int run = 0; run < settings.warmup; run++)
+    {
+        phase();
+    }
+
+    std::vector<double> samples(settings.repetitions);
+    for (int run = 0; run < settings.repetitions; run++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        phase();
+        samples[run] = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    }
+    return samples;
+}
+
+void reportPhase(const char *engine, int threads, const Simulation &simulation, const char *phase,
+                 std::vector<double> samples)
+{
+    std::sort(samples.begin(), samples.end());
+    size_t count = samples.size();
+    double median = count % 2 == 1 ? samples[count / 2] : 0.5 * (samples[count / 2 - 1] + samples[count / 2]);
+    double p95 = samples[std::min(count - 1, (size_t)std::ceil(0.95 * count) - 1)];
+
+    std::cout << engine << "," << threads << "," << simulation.particles.count << "," << simulation.radius << ","
+              << phase << "," << count << "," << median << "," << p95 << ","
+              << median / simulation.particles.count << std::endl;
+}
+
+void benchmarkEngine(const BenchmarkSettings &settings, const char *engine, int threads)
+{
+#ifdef _OPENMP
+    omp_set_num_threads(threads);
+#endif
+
+    for (long long numCircles = settings.minCircles; numCircles <= settings.maxCircles; numCircles *= 4)
+    {
+        // the same scene for every engine
+        Options options;
+        options.numCircles = (int)numCircles;
+        float radius = std::sqrt(4.0f * settings.areaFraction / (3.1415926f * numCircles));
+
+        Simulation simulation;
+        createScene(simulation, options, radius, 1.0f);
+        ParticleStore &particles = simulation.particles;
+
+        QuadTree tree;
+        reportPhase(engine, threads, simulation, "attraction",
+                    timePhase(settings, [&]() { applyAttraction(tree, particles, settings.attraction, 0.5f, radius); }));
+        reportPhase(engine, threads, simulation, "integrate",
+                    timePhase(settings, [&]() { integrateParticles(particles); }));
+        reportPhase(engine, threads, simulation, "wall_bounce",
+                    timePhase(settings, [&]() { reflectParticles(particles, radius); }));
+        reportPhase(engine, threads, simulation, "broadphase_grid",
+                    timePhase(settings, [&]() { buildGrid(simulation.grid, particles); }));
+        reportPhase(engine, threads, simulation, "narrowphase_grid",
+                    timePhase(settings, [&]() { findContactsInGrid(simulation.contacts, simulation.grid, particles, radius); }));
+        SweepAndPrune sweep;
+        reportPhase(engine, threads, simulation, "sweep_and_prune",
+                    timePhase(settings, [&]() { findContactsSweepAndPrune(simulation.contacts, sweep, particles, radius); }));
+        reportPhase(engine, threads, simulation, "verlet_build",
+                    timePhase(settings, [&]() { buildVerletList(simulation.verlet, particles, radius); }));
+        reportPhase(engine, threads, simulation, "narrowphase_verlet",
+                    timePhase(settings, [&]() { findContactsVerlet(simulation.contacts, simulation.verlet, particles, radius); }));
+        if (numCircles <= settings.maxBruteForce)
+        {
+            ContactList contacts;
+            reportPhase(engine, threads, simulation, "narrowphase_brute",
+                        timePhase(settings, [&]() { findContactsBruteForce(contacts, particles, radius); }));
+            TiledContacts tiles;
+            reportPhase(engine, threads, simulation, "narrowphase_tiled",
+                        timePhase(settings, [&]() { findContactsTiled(contacts, tiles, particles, radius); }));
+        }
+        reportPhase(engine, threads, simulation, "resolve",
+                    timePhase(settings, [&]() { resolveContacts(simulation.contacts, particles, 1.0f); }));
+        ContactColoring coloring;
+        reportPhase(engine, threads, simulation, "resolve_colored",
+                    timePhase(settings, [&]() { solveContactsColored(coloring, simulation.contacts, particles, 1.0f, 4); }));
+        reportPhase(engine, threads, simulation, "step",
+                    timePhase(settings, [&]() { stepSimulation(simulation); }));
+
+        // the same step once the storage is in Morton order (--reorder-interval)
+        reportPhase(engine, threads, simulation, "reorder",
+                    timePhase(settings, [&]() { reorderParticles(simulation.spatialOrder, particles); }));
+        resetSweepAndPrune(simulation.sweep);
+        resetVerletList(simulation.verlet);
+        reportPhase(engine, threads, simulation, "step_reordered",
+                    timePhase(settings, [&]() { stepSimulation(simulation); }));
+    }
+}
+
+int main(int argc, char **argv)
+{
+    BenchmarkSettings settings;
+    if (!parseBenchmarkOptions(argc, argv, settings))
+    {
+        return -1;
+    }
+
+    std::cout.precision(9);
+    std::cout << "engine,threads,circles,radius,phase,repetitions,median_ns,p95_ns,median_ns_per_circle" << std::endl;
+
+#ifdef _OPENMP
+    int threads = omp_get_max_threads(); // honours OMP_NUM_THREADS
+    benchmarkEngine(settings, "openmp", 1);
+    benchmarkEngine(settings, "openmp", threads);
+#else
+    benchmarkEngine(settings, "serial", 1);
+#endif
+
+    return 0;
+}
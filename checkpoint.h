@@ -0,0 +1,177 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "particleStore.h"
+
+// Binary checkpoints
+// ------------------
+// A checkpoint is the particle block exactly as it lives in memory, behind a
+// 64-byte header and followed by the stable id of every slot:
+//
+//   header | x | y | vx | vy | ids
+//
+// Each of x, y, vx and vy is `capacity` floats, padded with zeros like in a
+// ParticleStore, so the file is written with a single writev of the block and
+// restored by mapping it: the arrays are used in place, and pages are only
+// read from disk (and copied, since the mapping is private) when they are
+// touched. Numbers are stored in the machine's byte order.
+//
+// The file is written next to its destination and renamed over it once it is
+// complete, so a crash while saving leaves the previous checkpoint intact.
+
+const char checkpointMagic[8] = {'B', 'U', 'B', 'B', 'L', 'E', 'S', '\0'};
+const uint32_t checkpointVersion = 1;
+
+struct CheckpointHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t headerBytes;
+    int64_t step;
+    int32_t count;
+    int32_t capacity;
+    float radius;
+    float restitution;
+    uint64_t seed;
+    char reserved[16];
+};
+static_assert(sizeof(CheckpointHeader) == particleAlignment, "the arrays must stay aligned after the header");
+
+inline size_t checkpointArrayBytes(const CheckpointHeader &header)
+{
+    return 4 * sizeof(float) * (size_t)header.capacity;
+}
+
+inline size_t checkpointBytes(const CheckpointHeader &header)
+{
+    return sizeof(CheckpointHeader) + checkpointArrayBytes(header) + sizeof(int32_t) * (size_t)header.count;
+}
+
+// write header, block and ids to path with one writev (repeated only if the kernel writes less)
+inline bool writeCheckpointFile(const std::string &path, CheckpointHeader header, const ParticleStore &particles,
+                                const int *ids)
+{
+    memcpy(header.magic, checkpointMagic, sizeof(header.magic));
+    header.version = checkpointVersion;
+    header.headerBytes = sizeof(CheckpointHeader);
+    header.count = particles.count;
+    header.capacity = particles.capacity;
+    memset(header.reserved, 0, sizeof(header.reserved));
+
+    std::string temporaryPath = path + ".tmp";
+    int file = open(temporaryPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (file < 0)
+    {
+        std::cout << "Failed to write checkpoint " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    iovec parts[3] = {{&header, sizeof(header)},
+                      {particles.x, checkpointArrayBytes(header)},
+                      {(void *)ids, sizeof(int32_t) * (size_t)particles.count}};
+    iovec *part = parts;
+    int partsLeft = 3;
+    bool written = true;
+    while (partsLeft > 0)
+    {
+        ssize_t bytes = writev(file, part, partsLeft);
+        if (bytes < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (bytes <= 0)
+        {
+            written = false;
+            break;
+        }
+        // skip what was written; large files may take more than one call
+        while (partsLeft > 0 && (size_t)bytes >= part->iov_len)
+        {
+            bytes -= part->iov_len;
+            part++;
+            partsLeft--;
+        }
+        if (partsLeft > 0)
+        {
+            part->iov_base = (char *)part->iov_base + bytes;
+            part->iov_len -= bytes;
+        }
+    }
+
+    written = written && fsync(file) == 0;
+    written = close(file) == 0 && written;
+    if (!written || rename(temporaryPath.c_str(), path.c_str()) != 0)
+    {
+        std::cout << "Failed to write checkpoint " << path << ": " << strerror(errno) << std::endl;
+        unlink(temporaryPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+// map the checkpoint at path into particles and copy out its header and ids
+inline bool readCheckpointFile(const std::string &path, CheckpointHeader &header, ParticleStore &particles,
+                               std::vector<int> &ids)
+{
+    int file = open(path.c_str(), O_RDONLY);
+    if (file < 0)
+    {
+        std::cout << "Failed to open checkpoint " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    struct stat status;
+    if (fstat(file, &status) != 0 || (size_t)status.st_size < sizeof(CheckpointHeader))
+    {
+        std::cout << "Checkpoint " << path << " is too short" << std::endl;
+        close(file);
+        return false;
+    }
+
+    // a private writable mapping: the simulation changes its copy, never the file
+    size_t fileBytes = (size_t)status.st_size;
+    void *mapping = mmap(NULL, fileBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+    close(file);
+    if (mapping == MAP_FAILED)
+    {
+        std::cout << "Failed to map checkpoint " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    memcpy(&header, mapping, sizeof(header));
+    if (memcmp(header.magic, checkpointMagic, sizeof(header.magic)) != 0 || header.version != checkpointVersion ||
+        header.headerBytes != sizeof(CheckpointHeader) || header.count < 0 ||
+        header.capacity != paddedParticleCount(header.count) || checkpointBytes(header) != fileBytes)
+    {
+        std::cout << "Checkpoint " << path << " is not a version " << checkpointVersion << " checkpoint" << std::endl;
+        munmap(mapping, fileBytes);
+        return false;
+    }
+
+    particles.releaseBlock();
+    particles.mapping = mapping;
+    particles.mappingBytes = fileBytes;
+    particles.block = (char *)mapping + sizeof(CheckpointHeader);
+    particles.count = header.count;
+    particles.capacity = header.capacity;
+    particles.x = (float *)particles.block;
+    particles.y = particles.x + header.capacity;
+    particles.vx = particles.y + header.capacity;
+    particles.vy = particles.vx + header.capacity;
+
+    const int32_t *storedIds = (const int32_t *)((const char *)particles.block + checkpointArrayBytes(header));
+    ids.assign(storedIds, storedIds + header.count);
+    return true;
+}
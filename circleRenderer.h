@@ -0,0 +1,519 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+#include "options.h"
+#include "particleStore.h"
+
+// Circle rendering
+// ----------------
+// Fan: every circle is tessellated on the CPU into its own triangle fan of
+// segments + 2 vertices, uploaded every frame and drawn with one call per
+// circle.
+// Instanced: one unit circle fan is uploaded once; every frame only the circle
+// centers (8 bytes per circle) are streamed and all circles are drawn with a
+// single glDrawArraysInstanced call.
+// Sdf: like Instanced, but the shared mesh is a 4-vertex quad around each
+// circle, grown by two pixels so the outer half of the edge is not clipped,
+// and the fragment shader computes coverage, the anti-aliased edge and the
+// shimmer from the distance to the circle center, so the edge is smooth at any
+// resolution and there is no segment count to choose.
+//
+// The per-frame data is either copied into a freshly orphaned buffer
+// (UploadMode::Copy) or written in place into a persistently mapped buffer
+// split into circleRingRegions regions (UploadMode::Persistent). Each region
+// is guarded by a fence placed after the draw that reads it, so the CPU fills
+// one region while the GPU still draws from the others.
+
+const char *const fanVertexShaderSource = "#version 330 core\n"
+                                          "layout (location = 0) in vec3 aPos;\n"
+                                          "void main()\n"
+                                          "{\n"
+                                          "   gl_Position = vec4(aPos.x, aPos.y, aPos.z, 1.0);\n"
+                                          "}\0";
+
+const char *const instancedVertexShaderSource = R"(
+#version 330 core
+layout (location = 0) in vec3 aPos;    // unit circle vertex
+layout (location = 1) in vec2 aCenter; // per circle
+uniform float radius;
+
+void main()
+{
+    gl_Position = vec4(aCenter + radius * aPos.xy, aPos.z, 1.0);
+}
+)";
+
+const char *const sdfVertexShaderSource = R"(
+#version 330 core
+layout (location = 0) in vec3 aPos;    // corner of the [-1, 1] quad
+layout (location = 1) in vec2 aCenter; // per circle
+uniform float radius;
+uniform vec2 pixelSize; // size of a pixel in clip space
+out vec2 local; // position relative to the center, in radii
+
+void main()
+{
+    // grow the quad by two pixels so the part of the anti-aliased edge outside
+    // the circle is not clipped
+    local = aPos.xy * (1.0 + 2.0 * pixelSize / radius);
+    gl_Position = vec4(aCenter + radius * local, aPos.z, 1.0);
+}
+)";
+
+const char *const sdfFragmentShaderSource = R"(
+#version 330 core
+in vec2 local;
+uniform float radius;
+out vec4 FragColor;
+
+void main()
+{
+    // distance from the circle center, in radii (the edge is at 1)
+    float distance = length(local);
+
+    // one pixel wide anti-aliased edge
+    float edgeWidth = fwidth(distance);
+    float coverage = 1.0 - smoothstep(1.0 - edgeWidth, 1.0 + edgeWidth, distance);
+    if (coverage <= 0.0)
+        discard;
+
+    // Define bubble colors
+    vec3 bubbleColor = vec3(0.5, 0.5, 1.0); // Bubble color (blue)
+
+    // Add a shimmering effect based on distance and time
+    float shimmer = 0.1 * sin(distance * radius * 20.0 + 2.0 * 3.14159265359 * gl_FragCoord.x / 800.0);
+
+    FragColor = vec4(bubbleColor + vec3(shimmer), coverage);
+}
+)";
+
+const char *const bubbleFragmentShaderSource = R"(
+#version 330 core
+out vec4 FragColor;
+
+void main()
+{
+    // Define the center and radius of the bubble
+    vec2 center = vec2(0.5, 0.5);
+    float radius = 0.5;
+
+    // Calculate the distance from the fragment to the center
+    vec2 fragPos = gl_FragCoord.xy / 800.0; // Assuming a resolution of 800x600
+    float distance = length(fragPos - center);
+
+    // Define bubble colors
+    vec3 bubbleColor = vec3(0.5, 0.5, 1.0); // Bubble color (blue)
+
+    // Add a shimmering effect based on distance and time
+    float shimmer = 0.1 * sin(distance * 20.0 + 2.0 * 3.14159265359 * gl_FragCoord.x / 800.0);
+
+    // Combine the bubble color and shimmer effect
+    vec3 finalColor = bubbleColor + vec3(shimmer);
+
+    // Set the alpha value based on distance from the center
+    float alpha = smoothstep(radius - 0.02, radius + 0.02, distance);
+
+    // Add transparency to the bubble
+    alpha *= 0.5; // You can adjust this value for the desired level of transparency
+
+    FragColor = vec4(finalColor, alpha);
+}
+)";
+
+const int circleRingRegions = 3;
+
+struct CircleRenderer
+{
+    RenderMode mode = RenderMode::Instanced;
+    UploadMode upload = UploadMode::Persistent;
+    int numCircles = 0;
+    int segments = 0;
+    float radius = 0.0f;
+
+    unsigned int shaderProgram = 0;
+    unsigned int VAO = 0;
+    unsigned int meshVBO = 0;   // unit circle fan, instanced mode only
+    unsigned int circleVBO = 0; // per frame data: every fan vertex, or one center per circle
+
+    std::vector<float> circleData; // CPU side of circleVBO, copy upload only
+
+    float *mappedData = NULL; // all ring regions, persistent upload only
+    GLsync regionFences[circleRingRegions] = {};
+    int region = 0; // region written and drawn this frame
+
+    float *frameData = NULL; // where this frame's data is written
+
+    std::vector<float> rim; // (x, y) of the segments + 1 rim points around a center, fan mode only
+    void (*buildFan)(CircleRenderer &, const ParticleStore &) = NULL; // fan builder specialized for segments
+};
+
+// build, compile and link a shader program, printing any errors
+inline unsigned int compileShaderProgram(const char *vertexShaderSource, const char *fragmentShaderSource)
+{
+    // vertex shader
+    unsigned int vertexShader = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(vertexShader, 1, &vertexShaderSource, NULL);
+    glCompileShader(vertexShader);
+    // check for shader compile errors
+    int success;
+    char infoLog[512];
+    glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &success);
+    if (!success)
+    {
+        glGetShaderInfoLog(vertexShader, 512, NULL, infoLog);
+        std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n"
+                  << infoLog << std::endl;
+    }
+    // fragment shader
+    unsigned int fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(fragmentShader, 1, &fragmentShaderSource, NULL);
+    glCompileShader(fragmentShader);
+    // check for shader compile errors
+    glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &success);
+    if (!success)
+    {
+        glGetShaderInfoLog(fragmentShader, 512, NULL, infoLog);
+        std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n"
+                  << infoLog << std::endl;
+    }
+    // link shaders
+    unsigned int shaderProgram = glCreateProgram();
+    glAttachShader(shaderProgram, vertexShader);
+    glAttachShader(shaderProgram, fragmentShader);
+    glLinkProgram(shaderProgram);
+    // check for linking errors
+    glGetProgramiv(shaderProgram, GL_LINK_STATUS, &success);
+    if (!success)
+    {
+        glGetProgramInfoLog(shaderProgram, 512, NULL, infoLog);
+        std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n"
+                  << infoLog << std::endl;
+    }
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+
+    return shaderProgram;
+}
+
+// floats streamed to the GPU for every circle each frame
+inline int floatsPerCircle(const CircleRenderer &renderer)
+{
+    if (renderer.mode == RenderMode::Fan)
+    {
+        return 3 * (renderer.segments + 2); // (x, y, z) for each vertex
+    }
+    return 2; // center
+}
+
+// vertices of the shared mesh drawn for every instance
+inline int meshVertices(const CircleRenderer &renderer)
+{
+    return renderer.mode == RenderMode::Sdf ? 4 : renderer.segments + 2;
+}
+
+inline size_t floatsPerFrame(const CircleRenderer &renderer)
+{
+    return (size_t)floatsPerCircle(renderer) * renderer.numCircles;
+}
+
+// allocate circleVBO, which must be bound to GL_ARRAY_BUFFER
+inline void allocateCircleBuffer(CircleRenderer &renderer)
+{
+    size_t frameBytes = sizeof(float) * floatsPerFrame(renderer);
+
+    // glBufferStorage is core since OpenGL 4.4
+    if (renderer.upload == UploadMode::Persistent && !GLAD_GL_VERSION_4_4)
+    {
+        std::cout << "OpenGL 4.4 is not available, falling back to --upload copy" << std::endl;
+        renderer.upload = UploadMode::Copy;
+    }
+
+    if (renderer.upload == UploadMode::Persistent)
+    {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_ARRAY_BUFFER, circleRingRegions * frameBytes, NULL, flags);
+        renderer.mappedData = (float *)glMapBufferRange(GL_ARRAY_BUFFER, 0, circleRingRegions * frameBytes, flags);
+    }
+    else
+    {
+        renderer.circleData.assign(floatsPerFrame(renderer), 0.0f);
+        glBufferData(GL_ARRAY_BUFFER, frameBytes, NULL, GL_STREAM_DRAW);
+    }
+}
+
+// Write every circle's triangle fan: its center followed by the rim points
+// around it. The rim is computed once at init; with Segments fixed at compile
+// time the loop over it has a known trip count and is unrolled and
+// vectorized. Segments 0 takes the count from the renderer instead.
+template <int Segments>
+inline void buildFanVertices(CircleRenderer &renderer, const ParticleStore &particles)
+{
+    float *vertices = renderer.frameData;
+    const int segments = Segments > 0 ? Segments : renderer.segments;
+    const int spaceForVertices = 3 * (segments + 2);
+    const float *rim = renderer.rim.data();
+
+#pragma omp parallel for schedule(static)
+    for (int circle = 0; circle < renderer.numCircles; circle++)
+    {
+        float *fan = vertices + (size_t)spaceForVertices * circle;
+        const float x = particles.x[circle];
+        const float y = particles.y[circle];
+        fan[0] = x;
+        fan[1] = y;
+        fan[2] = 0.0f;
+
+        for (int i = 0; i <= segments; ++i)
+        {
+            fan[3 * (i + 1)] = x + rim[2 * i];
+            fan[3 * (i + 1) + 1] = y + rim[2 * i + 1];
+            fan[3 * (i + 1) + 2] = 0.0f;
+        }
+    }
+}
+
+inline void initCircleRenderer(CircleRenderer &renderer, RenderMode mode, UploadMode upload, int numCircles, int segments,
+                               float radius)
+{
+    renderer.mode = mode;
+    renderer.upload = upload;
+    renderer.numCircles = numCircles;
+    renderer.segments = segments;
+    renderer.radius = radius;
+
+    glGenVertexArrays(1, &renderer.VAO);
+    glGenBuffers(1, &renderer.circleVBO);
+    // bind the Vertex Array Object first, then bind and set vertex buffer(s), and then configure vertex attributes(s).
+    glBindVertexArray(renderer.VAO);
+
+    if (mode == RenderMode::Fan)
+    {
+        renderer.shaderProgram = compileShaderProgram(fanVertexShaderSource, bubbleFragmentShaderSource);
+
+        // the rim of a circle of this radius around the origin
+        renderer.rim.assign(2 * (segments + 1), 0.0f);
+        for (int i = 0; i <= segments; ++i)
+        {
+            float theta = 2.0f * 3.1415926f * float(i) / float(segments);
+            renderer.rim[2 * i] = radius * cos(theta);
+            renderer.rim[2 * i + 1] = radius * sin(theta);
+        }
+
+        // the common segment counts have their own builder
+        if (segments == 32)
+        {
+            renderer.buildFan = buildFanVertices<32>;
+        }
+        else if (segments == 64)
+        {
+            renderer.buildFan = buildFanVertices<64>;
+        }
+        else if (segments == 128)
+        {
+            renderer.buildFan = buildFanVertices<128>;
+        }
+        else if (segments == 360)
+        {
+            renderer.buildFan = buildFanVertices<360>;
+        }
+        else
+        {
+            renderer.buildFan = buildFanVertices<0>;
+        }
+
+        glBindBuffer(GL_ARRAY_BUFFER, renderer.circleVBO);
+        allocateCircleBuffer(renderer);
+
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void *)0);
+        glEnableVertexAttribArray(0);
+    }
+    else
+    {
+        std::vector<float> mesh;
+        if (mode == RenderMode::Sdf)
+        {
+            renderer.shaderProgram = compileShaderProgram(sdfVertexShaderSource, sdfFragmentShaderSource);
+
+            // the quad around the unit circle, as a triangle strip
+            mesh = {-1.0f, -1.0f, 0.0f,
+                    1.0f, -1.0f, 0.0f,
+                    -1.0f, 1.0f, 0.0f,
+                    1.0f, 1.0f, 0.0f};
+        }
+        else
+        {
+            renderer.shaderProgram = compileShaderProgram(instancedVertexShaderSource, bubbleFragmentShaderSource);
+
+            // the unit circle: its center followed by segments + 1 points on the rim
+            mesh.assign(3 * (segments + 2), 0.0f);
+            for (int i = 0; i <= segments; ++i)
+            {
+                float theta = 2.0f * 3.1415926f * float(i) / float(segments);
+                mesh[3 * (i + 1)] = cos(theta);
+                mesh[3 * (i + 1) + 1] = sin(theta);
+            }
+        }
+
+        glGenBuffers(1, &renderer.meshVBO);
+        glBindBuffer(GL_ARRAY_BUFFER, renderer.meshVBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(float) * mesh.size(), mesh.data(), GL_STATIC_DRAW);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void *)0);
+        glEnableVertexAttribArray(0);
+
+        // one center per instance
+        glBindBuffer(GL_ARRAY_BUFFER, renderer.circleVBO);
+        allocateCircleBuffer(renderer);
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void *)0);
+        glEnableVertexAttribArray(1);
+        glVertexAttribDivisor(1, 1);
+
+        glUseProgram(renderer.shaderProgram);
+        glUniform1f(glGetUniformLocation(renderer.shaderProgram, "radius"), radius);
+    }
+
+    // the anti-aliased edge of the sdf circles is blended over the background
+    if (mode == RenderMode::Sdf)
+    {
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    }
+
+    // note that this is allowed, the call to glVertexAttribPointer registered VBO as the vertex attribute's bound vertex buffer object so afterwards we can safely unbind
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// pick the memory this frame's data goes to, waiting until the GPU is done with it
+inline void beginCircleFrame(CircleRenderer &renderer)
+{
+    if (renderer.upload == UploadMode::Copy)
+    {
+        renderer.frameData = renderer.circleData.data();
+        return;
+    }
+
+    GLsync &fence = renderer.regionFences[renderer.region];
+    if (fence != NULL)
+    {
+        // with three regions the fence has normally been signaled long ago
+        while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED)
+        {
+        }
+        glDeleteSync(fence);
+        fence = NULL;
+    }
+    renderer.frameData = renderer.mappedData + renderer.region * floatsPerFrame(renderer);
+}
+
+// write this frame's data from the current circle positions
+inline void buildCircleData(CircleRenderer &renderer, const ParticleStore &particles)
+{
+    beginCircleFrame(renderer);
+
+    if (renderer.mode == RenderMode::Fan)
+    {
+        renderer.buildFan(renderer, particles);
+    }
+    else
+    {
+        float *vertices = renderer.frameData;
+
+#pragma omp parallel for schedule(static)
+        for (int circle = 0; circle < renderer.numCircles; circle++)
+        {
+            vertices[2 * circle] = particles.x[circle];
+            vertices[2 * circle + 1] = particles.y[circle];
+        }
+    }
+}
+
+inline void uploadCircleData(CircleRenderer &renderer)
+{
+    // the persistent mapping is coherent, the data is already in place
+    if (renderer.upload == UploadMode::Persistent)
+    {
+        return;
+    }
+
+    // orphan the old storage so the driver does not wait for the previous frame's draws
+    size_t frameBytes = sizeof(float) * renderer.circleData.size();
+    glBindBuffer(GL_ARRAY_BUFFER, renderer.circleVBO);
+    glBufferData(GL_ARRAY_BUFFER, frameBytes, NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, frameBytes, renderer.circleData.data());
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+inline void drawCircles(CircleRenderer &renderer, float time)
+{
+    glUseProgram(renderer.shaderProgram);
+    glUniform1f(glGetUniformLocation(renderer.shaderProgram, "time"), time); // Pass time to the shader
+
+    if (renderer.mode == RenderMode::Sdf)
+    {
+        // follows window resizes
+        GLint viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        glUniform2f(glGetUniformLocation(renderer.shaderProgram, "pixelSize"), 2.0f / (float)std::max(viewport[2], 1),
+                    2.0f / (float)std::max(viewport[3], 1));
+    }
+
+    glBindVertexArray(renderer.VAO);
+
+    // first circle of this frame's region in circleVBO
+    int firstCircle = renderer.upload == UploadMode::Persistent ? renderer.region * renderer.numCircles : 0;
+
+    if (renderer.mode == RenderMode::Fan)
+    {
+        // Render circles
+        for (int circle = firstCircle; circle < firstCircle + renderer.numCircles; circle++)
+        {
+            glDrawArrays(GL_TRIANGLE_FAN, circle * (renderer.segments + 2), renderer.segments + 2);
+        }
+    }
+    else
+    {
+        GLenum primitive = renderer.mode == RenderMode::Sdf ? GL_TRIANGLE_STRIP : GL_TRIANGLE_FAN;
+        if (firstCircle == 0)
+        {
+            glDrawArraysInstanced(primitive, 0, meshVertices(renderer), renderer.numCircles);
+        }
+        else
+        {
+            glDrawArraysInstancedBaseInstance(primitive, 0, meshVertices(renderer), renderer.numCircles, firstCircle);
+        }
+    }
+
+    if (renderer.upload == UploadMode::Persistent)
+    {
+        renderer.regionFences[renderer.region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        renderer.region = (renderer.region + 1) % circleRingRegions;
+    }
+}
+
+inline void destroyCircleRenderer(CircleRenderer &renderer)
+{
+    for (GLsync &fence : renderer.regionFences)
+    {
+        if (fence != NULL)
+        {
+            glDeleteSync(fence);
+        }
+    }
+    if (renderer.mappedData != NULL)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, renderer.circleVBO);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+    glDeleteVertexArrays(1, &renderer.VAO);
+    glDeleteBuffers(1, &renderer.circleVBO);
+    if (renderer.meshVBO != 0)
+    {
+        glDeleteBuffers(1, &renderer.meshVBO);
+    }
+    glDeleteProgram(renderer.shaderProgram);
+}
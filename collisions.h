@@ -0,0 +1,756 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "frameArena.h"
+#include "particleStore.h"
+
+// Circle-circle collision detection and response
+// ----------------------------------------------
+// Every circle has the same radius, so two circles touch when their centers are
+// closer than 2 * radius. The brute-force path compares every pair; the grid
+// path bins the circles into square cells at least 2 * radius wide, so a circle
+// can only touch circles in its own cell or one of the eight around it. The
+// sweep-and-prune path keeps the circles sorted along x across frames and only
+// compares circles whose x ranges overlap. The Verlet path keeps a list of
+// nearby circles per circle and only rebuilds it once circles moved far enough.
+
+// Each frame is split into two phases. Detection only reads the positions, so
+// it runs in parallel: the circles are cut into fixed blocks and every block
+// records its contacts in its own list. Resolution then walks the contacts in
+// (circle, otherCircle) order and applies the impulses one after the other,
+// which gives the same speeds whatever the number of threads and the same
+// result as the brute-force path. The original loop moved each circle and
+// tested it against later circles that had not moved yet; here every circle
+// moves before any contact is looked for, so the motion differs from it.
+
+struct Contact
+{
+    int circle;
+    int otherCircle;
+};
+
+const int contactBlockSize = 1024; // circles per detection block
+
+struct ContactList
+{
+    FrameArenas arenas;                      // scratch of the current search, reset when it starts
+    std::vector<ArenaArray<Contact>> blocks; // contacts found by each block of circles
+    std::vector<int> blockOffsets;
+    std::vector<Contact> contacts; // all contacts, sorted by (circle, otherCircle)
+};
+
+inline int numContactBlocks(int numCircles)
+{
+    return (numCircles + contactBlockSize - 1) / contactBlockSize;
+}
+
+// start a contact search: the scratch of the last one is given back
+inline void clearContactBlocks(ContactList &list, int numCircles)
+{
+    resetFrameArenas(list.arenas);
+    int numBlocks = numContactBlocks(numCircles);
+    if ((int)list.blocks.size() < numBlocks)
+    {
+        list.blocks.resize(numBlocks);
+    }
+    for (int block = 0; block < numBlocks; block++)
+    {
+        list.blocks[block].reset();
+    }
+}
+
+// concatenate the block lists in block order
+inline void gatherContacts(ContactList &list, int numCircles)
+{
+    int numBlocks = numContactBlocks(numCircles);
+    list.blockOffsets.resize(numBlocks + 1);
+    list.blockOffsets[0] = 0;
+    for (int block = 0; block < numBlocks; block++)
+    {
+        list.blockOffsets[block + 1] = list.blockOffsets[block] + (int)list.blocks[block].size();
+    }
+    list.contacts.resize(list.blockOffsets[numBlocks]);
+
+#pragma omp parallel for schedule(static)
+    for (int block = 0; block < numBlocks; block++)
+    {
+        std::copy(list.blocks[block].begin(), list.blocks[block].end(), list.contacts.begin() + list.blockOffsets[block]);
+    }
+}
+
+inline bool circlesOverlap(const ParticleStore &particles, int circle, int otherCircle, float radius)
+{
+    float dx = particles.x[circle] - particles.x[otherCircle];
+    float dy = particles.y[circle] - particles.y[otherCircle];
+    return std::sqrt(dx * dx + dy * dy) < 2.0f * radius;
+}
+
+inline void findContactsBruteForce(ContactList &list, const ParticleStore &particles, float radius)
+{
+    int numCircles = particles.count;
+    clearContactBlocks(list, numCircles);
+    int numBlocks = numContactBlocks(numCircles);
+
+    // the first blocks have the most pairs to test, so hand them out dynamically
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int block = 0; block < numBlocks; block++)
+    {
+        ArenaArray<Contact> &contacts = list.blocks[block];
+        FrameArena &arena = threadArena(list.arenas);
+        int end = std::min((block + 1) * contactBlockSize, numCircles);
+        for (int circle = block * contactBlockSize; circle < end; circle++)
+        {
+            for (int otherCircle = circle + 1; otherCircle < numCircles; otherCircle++)
+            {
+                if (circlesOverlap(particles, circle, otherCircle, radius))
+                {
+                    contacts.push_back(arena, {circle, otherCircle});
+                }
+            }
+        }
+    }
+
+    gatherContacts(list, numCircles);
+}
+
+// How much of the approach speed a contact takes away. With the elastic
+// default the factor (1 + restitution) / 2 is exactly 1 and folds away; any
+// other restitution is a runtime value.
+struct ElasticRestitution
+{
+    explicit ElasticRestitution(float)
+    {
+    }
+
+    template <typename Scalar>
+    Scalar impulse(Scalar approach) const
+    {
+        return approach;
+    }
+};
+
+struct GivenRestitution
+{
+    float restitution;
+
+    explicit GivenRestitution(float restitution) : restitution(restitution)
+    {
+    }
+
+    template <typename Scalar>
+    Scalar impulse(Scalar approach) const
+    {
+        return approach * (Scalar(1) + Scalar(restitution)) / Scalar(2);
+    }
+};
+
+// apply the impulse of every contact, in order, with the contact normal and
+// impulse computed in Scalar (float or double); the speeds stay floats
+template <typename Scalar, typename Restitution>
+inline void resolveContactsWith(const ContactList &list, ParticleStore &particles, Restitution restitution)
+{
+    for (const Contact &contact : list.contacts)
+    {
+        int circle = contact.circle;
+        int otherCircle = contact.otherCircle;
+
+        // Calculate the normal vector of the collision
+        Scalar normalX = Scalar(particles.x[otherCircle]) - Scalar(particles.x[circle]);
+        Scalar normalY = Scalar(particles.y[otherCircle]) - Scalar(particles.y[circle]);
+        Scalar length = std::sqrt(normalX * normalX + normalY * normalY);
+        normalX /= length;
+        normalY /= length;
+
+        // Calculate the relative velocity of the circles
+        Scalar relativeX = Scalar(particles.vx[otherCircle]) - Scalar(particles.vx[circle]);
+        Scalar relativeY = Scalar(particles.vy[otherCircle]) - Scalar(particles.vy[circle]);
+
+        // Calculate the impulse magnitude
+        Scalar impulseMagnitude = restitution.impulse(relativeX * normalX + relativeY * normalY);
+
+        // Apply the impulse to the circles
+        particles.vx[circle] = float(particles.vx[circle] + impulseMagnitude * normalX);
+        particles.vy[circle] = float(particles.vy[circle] + impulseMagnitude * normalY);
+        particles.vx[otherCircle] = float(particles.vx[otherCircle] - impulseMagnitude * normalX);
+        particles.vy[otherCircle] = float(particles.vy[otherCircle] - impulseMagnitude * normalY);
+    }
+}
+
+inline void resolveContacts(const ContactList &list, ParticleStore &particles, float restitution)
+{
+    resolveContactsWith<float>(list, particles, GivenRestitution(restitution));
+}
+
+// uniform grid over the [-1, 1] x [-1, 1] screen, rebuilt every frame
+struct UniformGrid
+{
+    float minCellSize = 0.0f; // cells are at least this wide, 0 before initGrid
+    float cellSize = 0.0f;
+    int cellsPerSide = 0; // chosen by each build from minCellSize and the circle count
+
+    std::vector<int> cellStart;   // first entry of each cell in cellCircles, plus one past the end
+    std::vector<int> cellCircles; // circle indices sorted by cell
+    std::vector<int> circleCell;  // cell of each circle
+};
+
+const int maxGridCellsPerSide = 1 << 15; // keeps the cell count within an int
+
+// the largest number of cells per side whose size is still at least
+// minCellSize, but no more than 16 cells per circle, so a tiny radius does not
+// make the cell table far larger than the scene
+inline int gridCellsPerSide(float minCellSize, int numCircles)
+{
+    double fitting = 2.0f / minCellSize;
+    double perCircle = 4.0 * std::ceil(std::sqrt(double(std::max(numCircles, 1))));
+    return (int)std::max(1.0, std::min(std::min(fitting, perCircle), double(maxGridCellsPerSide)));
+}
+
+inline void initGrid(UniformGrid &grid, float radius)
+{
+    grid.minCellSize = 2.0f * radius;
+    grid.cellsPerSide = 0;
+    grid.cellStart.clear(); // allocated by the first build
+}
+
+inline int gridCoordinate(const UniformGrid &grid, float position)
+{
+    // circles may overshoot the screen edge by one step before they bounce back
+    int cell = int((position + 1.0f) / grid.cellSize);
+    return std::min(std::max(cell, 0), grid.cellsPerSide - 1);
+}
+
+// counting sort of the circles into their cells
+inline void buildGrid(UniformGrid &grid, const ParticleStore &particles)
+{
+    int numCircles = particles.count;
+    grid.circleCell.resize(numCircles);
+    grid.cellCircles.resize(numCircles);
+
+    // the table keeps its memory from build to build, only a new size reallocates it
+    grid.cellsPerSide = gridCellsPerSide(grid.minCellSize, numCircles);
+    grid.cellSize = 2.0f / float(grid.cellsPerSide);
+    size_t numCells = size_t(grid.cellsPerSide) * size_t(grid.cellsPerSide);
+    if (grid.cellStart.size() != numCells + 1)
+    {
+        grid.cellStart.assign(numCells + 1, 0);
+    }
+    else
+    {
+        std::fill(grid.cellStart.begin(), grid.cellStart.end(), 0);
+    }
+
+    for (int circle = 0; circle < numCircles; circle++)
+    {
+        int cell = gridCoordinate(grid, particles.y[circle]) * grid.cellsPerSide + gridCoordinate(grid, particles.x[circle]);
+        grid.circleCell[circle] = cell;
+        grid.cellStart[cell + 1]++;
+    }
+
+    for (size_t cell = 1; cell < grid.cellStart.size(); cell++)
+    {
+        grid.cellStart[cell] += grid.cellStart[cell - 1];
+    }
+
+    // cellStart[cell] is used as the insertion cursor and shifted back afterwards
+    for (int circle = 0; circle < numCircles; circle++)
+    {
+        grid.cellCircles[grid.cellStart[grid.circleCell[circle]]++] = circle;
+    }
+    for (size_t cell = grid.cellStart.size() - 1; cell > 0; cell--)
+    {
+        grid.cellStart[cell] = grid.cellStart[cell - 1];
+    }
+    grid.cellStart[0] = 0;
+}
+
+// test the circles of an already built grid against their neighbouring cells
+inline void findContactsInGrid(ContactList &list, const UniformGrid &grid, const ParticleStore &particles, float radius)
+{
+    int numCircles = particles.count;
+    clearContactBlocks(list, numCircles);
+    int numBlocks = numContactBlocks(numCircles);
+
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int block = 0; block < numBlocks; block++)
+    {
+        ArenaArray<Contact> &contacts = list.blocks[block];
+        FrameArena &arena = threadArena(list.arenas);
+        int end = std::min((block + 1) * contactBlockSize, numCircles);
+        for (int circle = block * contactBlockSize; circle < end; circle++)
+        {
+            size_t first = contacts.size();
+            int cellX = grid.circleCell[circle] % grid.cellsPerSide;
+            int cellY = grid.circleCell[circle] / grid.cellsPerSide;
+
+            for (int y = std::max(cellY - 1, 0); y <= std::min(cellY + 1, grid.cellsPerSide - 1); y++)
+            {
+                for (int x = std::max(cellX - 1, 0); x <= std::min(cellX + 1, grid.cellsPerSide - 1); x++)
+                {
+                    int cell = y * grid.cellsPerSide + x;
+                    for (int entry = grid.cellStart[cell]; entry < grid.cellStart[cell + 1]; entry++)
+                    {
+                        // each pair is found once, by its lower index
+                        int otherCircle = grid.cellCircles[entry];
+                        if (otherCircle > circle && circlesOverlap(particles, circle, otherCircle, radius))
+                        {
+                            contacts.push_back(arena, {circle, otherCircle});
+                        }
+                    }
+                }
+            }
+
+            // neighbouring cells are visited in cell order, restore the index order
+            std::sort(contacts.begin() + first, contacts.end(),
+                      [](const Contact &a, const Contact &b) { return a.otherCircle < b.otherCircle; });
+        }
+    }
+
+    gatherContacts(list, numCircles);
+}
+
+inline void findContactsGrid(ContactList &list, UniformGrid &grid, const ParticleStore &particles, float radius)
+{
+    buildGrid(grid, particles);
+    findContactsInGrid(list, grid, particles, radius);
+}
+
+// Sweep and prune along x. The circles are kept sorted by their center x from
+// one frame to the next; they barely move in a frame, so an insertion sort
+// repairs the order in close to linear time. Every circle has the same radius,
+// so sorting the centers also sorts the interval endpoints, and a circle can
+// only touch the circles that follow it in the order by less than 2 * radius.
+struct SweepAndPrune
+{
+    std::vector<int> order;     // circle indices sorted by x, kept between frames
+    std::vector<float> sortedX; // x of each circle in order, scanned by the sweep
+    std::vector<float> sortedY; // y of each circle in order, so the sweep never leaves the sorted arrays
+};
+
+// forget the order, e.g. after the circles were renumbered; the next sweep sorts from scratch
+inline void resetSweepAndPrune(SweepAndPrune &sweep)
+{
+    sweep.order.clear();
+    sweep.sortedX.clear();
+    sweep.sortedY.clear();
+}
+
+inline void sortSweepAndPrune(SweepAndPrune &sweep, const ParticleStore &particles)
+{
+    int numCircles = particles.count;
+    if ((int)sweep.order.size() != numCircles)
+    {
+        sweep.order.resize(numCircles);
+        for (int circle = 0; circle < numCircles; circle++)
+        {
+            sweep.order[circle] = circle;
+        }
+        std::sort(sweep.order.begin(), sweep.order.end(),
+                  [&](int a, int b) { return particles.x[a] < particles.x[b]; });
+        sweep.sortedX.resize(numCircles);
+        sweep.sortedY.resize(numCircles);
+    }
+
+    int *order = sweep.order.data();
+    float *sortedX = sweep.sortedX.data();
+    for (int entry = 0; entry < numCircles; entry++)
+    {
+        sortedX[entry] = particles.x[order[entry]];
+    }
+
+    // insertion sort, only circles that passed a neighbour move
+    for (int entry = 1; entry < numCircles; entry++)
+    {
+        float x = sortedX[entry];
+        if (x >= sortedX[entry - 1])
+        {
+            continue;
+        }
+        int circle = order[entry];
+        int position = entry;
+        while (position > 0 && sortedX[position - 1] > x)
+        {
+            sortedX[position] = sortedX[position - 1];
+            order[position] = order[position - 1];
+            position--;
+        }
+        sortedX[position] = x;
+        order[position] = circle;
+    }
+
+    float *sortedY = sweep.sortedY.data();
+    for (int entry = 0; entry < numCircles; entry++)
+    {
+        sortedY[entry] = particles.y[order[entry]];
+    }
+}
+
+inline void findContactsSweepAndPrune(ContactList &list, SweepAndPrune &sweep, const ParticleStore &particles,
+                                      float radius)
+{
+    int numCircles = particles.count;
+    sortSweepAndPrune(sweep, particles);
+    clearContactBlocks(list, numCircles);
+    int numBlocks = numContactBlocks(numCircles);
+    const int *order = sweep.order.data();
+    const float *sortedX = sweep.sortedX.data();
+    const float *sortedY = sweep.sortedY.data();
+
+    // the blocks are runs of the sorted order rather than of circle indices
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int block = 0; block < numBlocks; block++)
+    {
+        ArenaArray<Contact> &contacts = list.blocks[block];
+        FrameArena &arena = threadArena(list.arenas);
+        int end = std::min((block + 1) * contactBlockSize, numCircles);
+        for (int entry = block * contactBlockSize; entry < end; entry++)
+        {
+            float limit = sortedX[entry] + 2.0f * radius;
+            for (int other = entry + 1; other < numCircles && sortedX[other] < limit; other++)
+            {
+                // same test as circlesOverlap, on the sorted copies; the distance
+                // is never below |dy|, so most candidates skip the square root
+                float dx = sortedX[entry] - sortedX[other];
+                float dy = sortedY[entry] - sortedY[other];
+                if (std::fabs(dy) < 2.0f * radius && std::sqrt(dx * dx + dy * dy) < 2.0f * radius)
+                {
+                    int circle = order[entry];
+                    int otherCircle = order[other];
+                    contacts.push_back(arena, {std::min(circle, otherCircle), std::max(circle, otherCircle)});
+                }
+            }
+        }
+    }
+
+    // restore the (circle, otherCircle) order the resolution depends on
+    gatherContacts(list, numCircles);
+    std::sort(list.contacts.begin(), list.contacts.end(), [](const Contact &a, const Contact &b) {
+        return a.circle < b.circle || (a.circle == b.circle && a.otherCircle < b.otherCircle);
+    });
+}
+
+// Verlet neighbor lists. Every circle keeps the later circles within
+// 2 * radius + skin of it, found with a grid of cells at least that wide. As
+// long as no circle has moved more than skin / 2 since, no pair can have closed
+// the gap, so the lists stay complete and only they need to be tested; they are
+// rebuilt when some circle moves further.
+struct VerletList
+{
+    float skin = 0.0f;
+    UniformGrid grid; // cells of at least 2 * radius + skin, only used while rebuilding
+
+    std::vector<int> neighborStart; // first entry of each circle in neighbors, plus one past the end
+    std::vector<int> neighbors;     // later circles within reach, sorted by index for each circle
+    std::vector<std::vector<int>> blockNeighbors;
+    std::vector<float> referenceX; // positions at the last rebuild
+    std::vector<float> referenceY;
+    long long rebuilds = 0;
+};
+
+inline void initVerletList(VerletList &verlet, float skin)
+{
+    verlet.skin = skin;
+    verlet.grid = UniformGrid(); // sized at the first build, only scenes using the lists pay for it
+    verlet.neighborStart.clear();
+    verlet.rebuilds = 0;
+}
+
+// forget the lists, e.g. after the circles were renumbered; the next step rebuilds them
+inline void resetVerletList(VerletList &verlet)
+{
+    verlet.neighborStart.clear();
+}
+
+inline bool verletListExpired(const VerletList &verlet, const ParticleStore &particles)
+{
+    int numCircles = particles.count;
+    if ((int)verlet.neighborStart.size() != numCircles + 1)
+    {
+        return true;
+    }
+
+    // compare squared displacements against (skin / 2)^2
+    float limit = 0.25f * verlet.skin * verlet.skin;
+    float maxDisplacement = 0.0f;
+#pragma omp parallel for schedule(static) reduction(max : maxDisplacement)
+    for (int circle = 0; circle < numCircles; circle++)
+    {
+        float dx = particles.x[circle] - verlet.referenceX[circle];
+        float dy = particles.y[circle] - verlet.referenceY[circle];
+        maxDisplacement = std::max(maxDisplacement, dx * dx + dy * dy);
+    }
+    return maxDisplacement > limit;
+}
+
+inline void buildVerletList(VerletList &verlet, const ParticleStore &particles, float radius)
+{
+    int numCircles = particles.count;
+    int numBlocks = numContactBlocks(numCircles);
+    UniformGrid &grid = verlet.grid;
+    if (grid.minCellSize == 0.0f)
+    {
+        initGrid(grid, radius + 0.5f * verlet.skin);
+    }
+    buildGrid(grid, particles);
+
+    verlet.neighborStart.assign(numCircles + 1, 0);
+    if ((int)verlet.blockNeighbors.size() < numBlocks)
+    {
+        verlet.blockNeighbors.resize(numBlocks);
+    }
+    float reach = 2.0f * radius + verlet.skin;
+
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int block = 0; block < numBlocks; block++)
+    {
+        std::vector<int> &neighbors = verlet.blockNeighbors[block];
+        neighbors.clear();
+        int end = std::min((block + 1) * contactBlockSize, numCircles);
+        for (int circle = block * contactBlockSize; circle < end; circle++)
+        {
+            size_t first = neighbors.size();
+            int cellX = grid.circleCell[circle] % grid.cellsPerSide;
+            int cellY = grid.circleCell[circle] / grid.cellsPerSide;
+
+            for (int y = std::max(cellY - 1, 0); y <= std::min(cellY + 1, grid.cellsPerSide - 1); y++)
+            {
+                for (int x = std::max(cellX - 1, 0); x <= std::min(cellX + 1, grid.cellsPerSide - 1); x++)
+                {
+                    int cell = y * grid.cellsPerSide + x;
+                    for (int entry = grid.cellStart[cell]; entry < grid.cellStart[cell + 1]; entry++)
+                    {
+                        int otherCircle = grid.cellCircles[entry];
+                        float dx = particles.x[circle] - particles.x[otherCircle];
+                        float dy = particles.y[circle] - particles.y[otherCircle];
+                        if (otherCircle > circle && std::sqrt(dx * dx + dy * dy) < reach)
+                        {
+                            neighbors.push_back(otherCircle);
+                        }
+                    }
+                }
+            }
+
+            // sorted lists make the contacts come out in index order
+            std::sort(neighbors.begin() + first, neighbors.end());
+            verlet.neighborStart[circle + 1] = (int)(neighbors.size() - first);
+        }
+    }
+
+    for (int circle = 0; circle < numCircles; circle++)
+    {
+        verlet.neighborStart[circle + 1] += verlet.neighborStart[circle];
+    }
+    verlet.neighbors.resize(verlet.neighborStart[numCircles]);
+    verlet.referenceX.assign(particles.x, particles.x + numCircles);
+    verlet.referenceY.assign(particles.y, particles.y + numCircles);
+
+#pragma omp parallel for schedule(static)
+    for (int block = 0; block < numBlocks; block++)
+    {
+        const std::vector<int> &neighbors = verlet.blockNeighbors[block];
+        std::copy(neighbors.begin(), neighbors.end(), verlet.neighbors.begin() + verlet.neighborStart[block * contactBlockSize]);
+    }
+    verlet.rebuilds++;
+}
+
+// test only the listed pairs, rebuilding the lists first when they expired
+inline void findContactsVerlet(ContactList &list, VerletList &verlet, const ParticleStore &particles, float radius)
+{
+    if (verletListExpired(verlet, particles))
+    {
+        buildVerletList(verlet, particles, radius);
+    }
+
+    int numCircles = particles.count;
+    clearContactBlocks(list, numCircles);
+    int numBlocks = numContactBlocks(numCircles);
+
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int block = 0; block < numBlocks; block++)
+    {
+        ArenaArray<Contact> &contacts = list.blocks[block];
+        FrameArena &arena = threadArena(list.arenas);
+        int end = std::min((block + 1) * contactBlockSize, numCircles);
+        for (int circle = block * contactBlockSize; circle < end; circle++)
+        {
+            for (int entry = verlet.neighborStart[circle]; entry < verlet.neighborStart[circle + 1]; entry++)
+            {
+                int otherCircle = verlet.neighbors[entry];
+                if (circlesOverlap(particles, circle, otherCircle, radius))
+                {
+                    contacts.push_back(arena, {circle, otherCircle});
+                }
+            }
+        }
+    }
+
+    gatherContacts(list, numCircles);
+}
+
+// Tiled all-pairs. When the circles pile up in one spot every grid cell holds
+// most of them and the broadphases above fall back to comparing all pairs, so
+// this path does that as fast as it can: the circles are cut into tiles small
+// enough to stay in L1, every pair of tiles is a separate task, and the test
+// compares squared distances of 8 pairs per AVX2 instruction. The squared test
+// is a little generous, so it never misses a contact circlesOverlap would
+// find; only its hits are checked with circlesOverlap, which keeps the
+// contacts identical to the brute-force path.
+const int contactTileSize = 256; // circles per tile, a divisor of contactBlockSize
+
+struct TiledContacts
+{
+    std::vector<ArenaArray<Contact>> pairContacts; // contacts found by each pair of tiles, in the list's arenas
+};
+
+inline int numContactTiles(int numCircles)
+{
+    return (numCircles + contactTileSize - 1) / contactTileSize;
+}
+
+// index of the pair of tiles (tile, otherTile), tile <= otherTile, in row-major order
+inline int tilePairIndex(int numTiles, int tile, int otherTile)
+{
+    return tile * numTiles - tile * (tile - 1) / 2 + (otherTile - tile);
+}
+
+// contacts between the circles of tile and those of otherTile, in (circle, otherCircle) order within each tile pair
+inline void findTileContacts(ArenaArray<Contact> &contacts, FrameArena &arena, const ParticleStore &particles, int tile,
+                             int otherTile, float radius)
+{
+    int numCircles = particles.count;
+    int begin = tile * contactTileSize;
+    int end = std::min(begin + contactTileSize, numCircles);
+    int otherBegin = otherTile * contactTileSize;
+    int otherEnd = std::min(otherBegin + contactTileSize, numCircles);
+
+    // (2 * radius)^2 with room for the rounding of the exact test
+    float reach = 4.0f * radius * radius * (1.0f + 1e-5f);
+
+    for (int circle = begin; circle < end; circle++)
+    {
+        // only later circles, within the tile itself
+        int first = tile == otherTile ? circle + 1 : otherBegin;
+        int otherCircle = first;
+
+#ifdef __AVX2__
+        const __m256 x = _mm256_set1_ps(particles.x[circle]);
+        const __m256 y = _mm256_set1_ps(particles.y[circle]);
+        const __m256 reachSquared = _mm256_set1_ps(reach);
+        const __m256i lastLane = _mm256_set1_epi32(otherEnd - 1);
+        const __m256i firstLane = _mm256_set1_epi32(first);
+        const __m256i laneOffsets = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+        // whole aligned groups of 8; the padding past the last circle is masked out
+        for (otherCircle = first / particleLanes * particleLanes; otherCircle < otherEnd; otherCircle += particleLanes)
+        {
+            __m256 dx = _mm256_sub_ps(_mm256_load_ps(particles.x + otherCircle), x);
+            __m256 dy = _mm256_sub_ps(_mm256_load_ps(particles.y + otherCircle), y);
+            __m256 distanceSquared = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+            int hits = _mm256_movemask_ps(_mm256_cmp_ps(distanceSquared, reachSquared, _CMP_LT_OQ));
+            if (hits == 0)
+            {
+                continue;
+            }
+
+            __m256i lanes = _mm256_add_epi32(_mm256_set1_epi32(otherCircle), laneOffsets);
+            __m256i outside = _mm256_or_si256(_mm256_cmpgt_epi32(firstLane, lanes), _mm256_cmpgt_epi32(lanes, lastLane));
+            hits &= ~_mm256_movemask_ps(_mm256_castsi256_ps(outside));
+            while (hits != 0)
+            {
+                int lane = __builtin_ctz(hits);
+                hits &= hits - 1;
+                if (circlesOverlap(particles, circle, otherCircle + lane, radius))
+                {
+                    contacts.push_back(arena, {circle, otherCircle + lane});
+                }
+            }
+        }
+#else
+        for (; otherCircle < otherEnd; otherCircle++)
+        {
+            float dx = particles.x[otherCircle] - particles.x[circle];
+            float dy = particles.y[otherCircle] - particles.y[circle];
+            if (dx * dx + dy * dy < reach && circlesOverlap(particles, circle, otherCircle, radius))
+            {
+                contacts.push_back(arena, {circle, otherCircle});
+            }
+        }
+#endif
+    }
+}
+
+inline void findContactsTiled(ContactList &list, TiledContacts &tiles, const ParticleStore &particles, float radius)
+{
+    int numCircles = particles.count;
+    int numTiles = numContactTiles(numCircles);
+    int numPairs = numTiles * (numTiles + 1) / 2;
+    if ((int)tiles.pairContacts.size() < numPairs)
+    {
+        tiles.pairContacts.resize(numPairs);
+    }
+    clearContactBlocks(list, numCircles);
+
+    // every pair of tiles is an independent task with its own output
+#pragma omp parallel for collapse(2) schedule(dynamic, 4)
+    for (int tile = 0; tile < numTiles; tile++)
+    {
+        for (int otherTile = 0; otherTile < numTiles; otherTile++)
+        {
+            if (otherTile >= tile)
+            {
+                ArenaArray<Contact> &contacts = tiles.pairContacts[tilePairIndex(numTiles, tile, otherTile)];
+                contacts.reset();
+                findTileContacts(contacts, threadArena(list.arenas), particles, tile, otherTile, radius);
+            }
+        }
+    }
+
+    // a row of tile pairs holds the contacts of one tile of circles ordered by
+    // (otherTile, circle, otherCircle); a stable counting sort on the circle
+    // restores (circle, otherCircle) order, and rows fill the blocks in order
+    int numBlocks = numContactBlocks(numCircles);
+    const int tilesPerBlock = contactBlockSize / contactTileSize;
+
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int block = 0; block < numBlocks; block++)
+    {
+        ArenaArray<Contact> &contacts = list.blocks[block];
+        FrameArena &arena = threadArena(list.arenas);
+        int counts[contactTileSize + 1];
+        for (int tile = block * tilesPerBlock; tile < std::min((block + 1) * tilesPerBlock, numTiles); tile++)
+        {
+            int rowBegin = tilePairIndex(numTiles, tile, tile);
+            int rowEnd = rowBegin + (numTiles - tile);
+            int tileBegin = tile * contactTileSize;
+
+            std::fill(counts, counts + contactTileSize + 1, 0);
+            size_t rowSize = 0;
+            for (int pair = rowBegin; pair < rowEnd; pair++)
+            {
+                for (const Contact &contact : tiles.pairContacts[pair])
+                {
+                    counts[contact.circle - tileBegin + 1]++;
+                }
+                rowSize += tiles.pairContacts[pair].size();
+            }
+            for (int circle = 0; circle < contactTileSize; circle++)
+            {
+                counts[circle + 1] += counts[circle];
+            }
+
+            size_t first = contacts.size();
+            contacts.resize(arena, first + rowSize);
+            for (int pair = rowBegin; pair < rowEnd; pair++)
+            {
+                for (const Contact &contact : tiles.pairContacts[pair])
+                {
+                    contacts[first + counts[contact.circle - tileBegin]++] = contact;
+                }
+            }
+        }
+    }
+
+    gatherContacts(list, numCircles);
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "particleStore.h"
+#include "collisions.h"
+
+// Graph-colored contact solver
+// ----------------------------
+// resolveContacts applies the impulses one contact after the other, so every
+// contact sees the speeds left by the ones before it and the loop cannot be
+// split between threads. Here the contacts are first colored so that no two
+// contacts of one color share a circle. The contacts of a color are then
+// independent and are resolved in parallel without atomics, one color after
+// the other (a Gauss-Seidel sweep over colors), and the sweep is repeated a
+// few times so the impulses in dense clusters converge.
+//
+// Repeated sweeps must not undo earlier ones, so only contacts whose circles
+// still approach each other get an impulse; the sequential solver applies it
+// unconditionally, like the original loop. The colors only depend on the
+// contact order, so the result does not depend on the number of threads.
+
+struct ContactColoring
+{
+    std::vector<int> contactColor;    // color of each contact
+    std::vector<uint64_t> usedColors; // colors of the current pass already touching each circle
+    std::vector<int> colorStart;      // first contact of each color in contacts, plus one past the end
+    std::vector<Contact> contacts;    // contacts sorted by color, in their original order within a color
+    int numColors = 0;
+};
+
+// greedy coloring in contact order: every contact takes the lowest color not
+// used yet by either of its circles. A pass hands out 64 colors with one bit
+// mask per circle; contacts that find them all taken wait for the next pass.
+inline void colorContacts(ContactColoring &coloring, const ContactList &list, int numCircles)
+{
+    const std::vector<Contact> &contacts = list.contacts;
+    int numContacts = (int)contacts.size();
+    coloring.contactColor.assign(numContacts, -1);
+    coloring.numColors = 0;
+
+    int remaining = numContacts;
+    for (int pass = 0; remaining > 0; pass++)
+    {
+        coloring.usedColors.assign(numCircles, 0);
+        for (int contact = 0; contact < numContacts; contact++)
+        {
+            if (coloring.contactColor[contact] >= 0)
+            {
+                continue;
+            }
+            uint64_t used = coloring.usedColors[contacts[contact].circle] | coloring.usedColors[contacts[contact].otherCircle];
+            if (used == ~0ull)
+            {
+                continue;
+            }
+            int color = __builtin_ctzll(~used);
+            coloring.usedColors[contacts[contact].circle] |= 1ull << color;
+            coloring.usedColors[contacts[contact].otherCircle] |= 1ull << color;
+            coloring.contactColor[contact] = 64 * pass + color;
+            coloring.numColors = std::max(coloring.numColors, 64 * pass + color + 1);
+            remaining--;
+        }
+    }
+
+    // counting sort by color
+    coloring.colorStart.assign(coloring.numColors + 1, 0);
+    for (int contact = 0; contact < numContacts; contact++)
+    {
+        coloring.colorStart[coloring.contactColor[contact] + 1]++;
+    }
+    for (int color = 0; color < coloring.numColors; color++)
+    {
+        coloring.colorStart[color + 1] += coloring.colorStart[color];
+    }
+    coloring.contacts.resize(numContacts);
+    std::vector<int> &cursor = coloring.contactColor; // no longer needed, reused as insertion cursor
+    for (int contact = 0; contact < numContacts; contact++)
+    {
+        int color = cursor[contact];
+        cursor[contact] = coloring.colorStart[color]++;
+    }
+    for (int contact = 0; contact < numContacts; contact++)
+    {
+        coloring.contacts[cursor[contact]] = contacts[contact];
+    }
+    for (int color = coloring.numColors; color > 0; color--)
+    {
+        coloring.colorStart[color] = coloring.colorStart[color - 1];
+    }
+    coloring.colorStart[0] = 0;
+}
+
+template <typename Scalar, typename Restitution>
+inline void solveContactsColoredWith(ContactColoring &coloring, const ContactList &list, ParticleStore &particles,
+                                     Restitution restitution, int iterations)
+{
+    colorContacts(coloring, list, particles.count);
+
+    // one team for all the sweeps; the barrier at the end of each color keeps them in order
+#pragma omp parallel
+    for (int iteration = 0; iteration < iterations; iteration++)
+    {
+        for (int color = 0; color < coloring.numColors; color++)
+        {
+#pragma omp for schedule(static)
+            for (int entry = coloring.colorStart[color]; entry < coloring.colorStart[color + 1]; entry++)
+            {
+                int circle = coloring.contacts[entry].circle;
+                int otherCircle = coloring.contacts[entry].otherCircle;
+
+                Scalar normalX = Scalar(particles.x[otherCircle]) - Scalar(particles.x[circle]);
+                Scalar normalY = Scalar(particles.y[otherCircle]) - Scalar(particles.y[circle]);
+                Scalar length = std::sqrt(normalX * normalX + normalY * normalY);
+                normalX /= length;
+                normalY /= length;
+
+                Scalar relativeX = Scalar(particles.vx[otherCircle]) - Scalar(particles.vx[circle]);
+                Scalar relativeY = Scalar(particles.vy[otherCircle]) - Scalar(particles.vy[circle]);
+                Scalar approach = relativeX * normalX + relativeY * normalY;
+
+                // already separating, possibly thanks to an earlier sweep
+                if (!(approach < Scalar(0)))
+                {
+                    continue;
+                }
+
+                Scalar impulseMagnitude = restitution.impulse(approach);
+                particles.vx[circle] = float(particles.vx[circle] + impulseMagnitude * normalX);
+                particles.vy[circle] = float(particles.vy[circle] + impulseMagnitude * normalY);
+                particles.vx[otherCircle] = float(particles.vx[otherCircle] - impulseMagnitude * normalX);
+                particles.vy[otherCircle] = float(particles.vy[otherCircle] - impulseMagnitude * normalY);
+            }
+        }
+    }
+}
+
+inline void solveContactsColored(ContactColoring &coloring, const ContactList &list, ParticleStore &particles,
+                                 float restitution, int iterations)
+{
+    solveContactsColoredWith<float>(coloring, list, particles, GivenRestitution(restitution), iterations);
+}
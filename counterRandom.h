@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+
+// Counter-based random numbers
+// ----------------------------
+// Instead of a generator whose state advances with every call, a random
+// number is a hash of (seed, index, stream): the SplitMix64 finalizer applied
+// to a combination of the three. Any circle's numbers can be computed on their
+// own, in any order and on any thread, and a seed always gives the same scene
+// whatever the thread count, compiler or platform.
+
+// one of the independent random numbers of each index
+enum RandomStream
+{
+    StreamPositionX,
+    StreamPositionY
+};
+
+inline uint64_t splitMix64(uint64_t value)
+{
+    value += 0x9e3779b97f4a7c15ull;
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ull;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebull;
+    return value ^ (value >> 31);
+}
+
+inline uint64_t counterRandom(uint64_t seed, uint64_t index, RandomStream stream)
+{
+    // hashing the seed first keeps nearby seeds from giving shifted copies of one sequence
+    return splitMix64(splitMix64(seed) ^ (index * 4 + stream));
+}
+
+// uniform in [0, 1), from the top 24 bits so every value is exact in a float
+inline float counterRandomFloat(uint64_t seed, uint64_t index, RandomStream stream)
+{
+    return float(counterRandom(seed, index, stream) >> 40) * (1.0f / 16777216.0f);
+}
@@ -0,0 +1,344 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <vector>
+
+#include "particleStore.h"
+#include "collisions.h"
+
+// Event-driven engine
+// -------------------
+// Between collisions every circle moves in a straight line at constant speed,
+// so instead of stepping all circles and testing for overlaps every frame the
+// engine predicts when each circle will next hit a wall or another circle,
+// keeps those events in a priority queue and jumps from one event to the next.
+// The cost follows the number of collisions rather than frames x circles, and
+// circles touch exactly at the moment of impact instead of overlapping.
+//
+// Each circle carries its own time: its stored position is where it was at
+// that time, and it is only moved when it takes part in an event (and at the
+// end of a frame, so the arrays always hold the positions of the frame).
+// Events are never removed from the queue; every circle counts its collisions
+// and an event is stale once a count changed since it was predicted.
+//
+// Only circles in neighbouring cells of a grid at least 2 * radius wide are
+// tested against each other. Leaving a cell is an event too, after which the
+// circle is tested against its new neighbours. Circles that already overlap
+// (the random placement does not avoid it) pass through each other until they
+// have separated; only touching circles that still approach collide at once.
+
+const int eventWallX = -1; // otherCircle of an event with a vertical wall
+const int eventWallY = -2; // otherCircle of an event with a horizontal wall
+const int eventCell = -3;  // otherCircle of an event leaving the current cell
+
+struct CollisionEvent
+{
+    double time;
+    int circle;
+    int otherCircle; // another circle, or one of the event kinds above
+    int circleCount; // collision counts of both circles when the event was predicted
+    int otherCount;
+
+    bool operator>(const CollisionEvent &other) const
+    {
+        return time > other.time;
+    }
+};
+
+struct EventEngine
+{
+    bool initialized = false;
+    double now = 0.0; // in steps
+
+    float cellSize = 0.0f;
+    int cellsPerSide = 0;
+    std::vector<std::vector<int>> cells; // circles in each cell, in no particular order
+    std::vector<int> circleCell;
+    std::vector<int> cellSlot; // position of each circle in its cell's list
+
+    std::vector<double> circleTime; // time of each circle's stored position
+    std::vector<int> collisionCount;
+    std::vector<CollisionEvent> queue; // min-heap on time
+    size_t compactSize = 0;            // queue size at which the stale events are dropped
+
+    long long collisions = 0;
+};
+
+// start from scratch at the next advance, e.g. after the circles were renumbered
+inline void resetEventEngine(EventEngine &engine)
+{
+    engine.initialized = false;
+}
+
+// queue an event time steps from now, unless it never happens
+inline void pushEvent(EventEngine &engine, double time, int circle, int otherCircle)
+{
+    if (time == INFINITY)
+    {
+        return;
+    }
+    time += engine.now;
+    int otherCount = otherCircle >= 0 ? engine.collisionCount[otherCircle] : 0;
+    engine.queue.push_back({time, circle, otherCircle, engine.collisionCount[circle], otherCount});
+    std::push_heap(engine.queue.begin(), engine.queue.end(), std::greater<CollisionEvent>());
+}
+
+inline bool eventIsStale(const EventEngine &engine, const CollisionEvent &event)
+{
+    return event.circleCount != engine.collisionCount[event.circle] ||
+           (event.otherCircle >= 0 && event.otherCount != engine.collisionCount[event.otherCircle]);
+}
+
+// move circle along its speed up to the engine's current time
+inline void advanceCircle(EventEngine &engine, ParticleStore &particles, int circle)
+{
+    float elapsed = float(engine.now - engine.circleTime[circle]);
+    particles.x[circle] += particles.vx[circle] * elapsed;
+    particles.y[circle] += particles.vy[circle] * elapsed;
+    engine.circleTime[circle] = engine.now;
+}
+
+inline int eventCellCoordinate(const EventEngine &engine, float position)
+{
+    int cell = int((position + 1.0f) / engine.cellSize);
+    return std::min(std::max(cell, 0), engine.cellsPerSide - 1);
+}
+
+inline void moveToCell(EventEngine &engine, int circle, int cell)
+{
+    // swap the circle out of its old cell list
+    std::vector<int> &oldCell = engine.cells[engine.circleCell[circle]];
+    int last = oldCell.back();
+    oldCell[engine.cellSlot[circle]] = last;
+    engine.cellSlot[last] = engine.cellSlot[circle];
+    oldCell.pop_back();
+
+    engine.cellSlot[circle] = (int)engine.cells[cell].size();
+    engine.cells[cell].push_back(circle);
+    engine.circleCell[circle] = cell;
+}
+
+// time until a coordinate moving at speed reaches lower or upper, infinite when it never does
+inline double wallTime(float position, float speed, float lower, float upper)
+{
+    if (speed > 0.0f)
+    {
+        return std::max(0.0, (double(upper) - position) / speed);
+    }
+    if (speed < 0.0f)
+    {
+        return std::max(0.0, (double(lower) - position) / speed);
+    }
+    return INFINITY;
+}
+
+// time until a coordinate leaves cell (a column or row) into the next one, infinite at the edge of the grid
+inline double cellExitTime(const EventEngine &engine, float position, float speed, int cell)
+{
+    float lower = cell > 0 ? -1.0f + cell * engine.cellSize : -INFINITY;
+    float upper = cell < engine.cellsPerSide - 1 ? -1.0f + (cell + 1) * engine.cellSize : INFINITY;
+    return wallTime(position, speed, lower, upper);
+}
+
+// time until the centers of two circles are 2 * radius apart, infinite when they miss
+inline double pairTime(const EventEngine &engine, const ParticleStore &particles, int circle, int otherCircle,
+                       float radius)
+{
+    // both positions at the current time
+    double circleElapsed = engine.now - engine.circleTime[circle];
+    double otherElapsed = engine.now - engine.circleTime[otherCircle];
+    double dx = (particles.x[otherCircle] + particles.vx[otherCircle] * otherElapsed) -
+                (particles.x[circle] + particles.vx[circle] * circleElapsed);
+    double dy = (particles.y[otherCircle] + particles.vy[otherCircle] * otherElapsed) -
+                (particles.y[circle] + particles.vy[circle] * circleElapsed);
+    double dvx = particles.vx[otherCircle] - particles.vx[circle];
+    double dvy = particles.vy[otherCircle] - particles.vy[circle];
+
+    double approach = dx * dvx + dy * dvy;
+    if (approach >= 0.0)
+    {
+        return INFINITY; // separating or at rest
+    }
+
+    double contactDistance = 4.0 * double(radius) * radius;
+    double gap = dx * dx + dy * dy - contactDistance;
+    if (gap < 0.0)
+    {
+        // touching within rounding collides now, a real overlap is left alone
+        return gap > -1e-4 * contactDistance ? 0.0 : INFINITY;
+    }
+
+    double speed = dvx * dvx + dvy * dvy;
+    double discriminant = approach * approach - speed * gap;
+    if (discriminant < 0.0)
+    {
+        return INFINITY;
+    }
+    // the smaller root of speed * t^2 + 2 * approach * t + gap, in a form without cancellation
+    return gap / (-approach + std::sqrt(discriminant));
+}
+
+// queue the next wall, cell and pair events of one circle
+inline void predictEvents(EventEngine &engine, const ParticleStore &particles, int circle, float radius)
+{
+    float x = particles.x[circle];
+    float y = particles.y[circle];
+    float vx = particles.vx[circle];
+    float vy = particles.vy[circle];
+    pushEvent(engine, wallTime(x, vx, -1.0f + radius, 1.0f - radius), circle, eventWallX);
+    pushEvent(engine, wallTime(y, vy, -1.0f + radius, 1.0f - radius), circle, eventWallY);
+
+    int cellX = engine.circleCell[circle] % engine.cellsPerSide;
+    int cellY = engine.circleCell[circle] / engine.cellsPerSide;
+    pushEvent(engine, std::min(cellExitTime(engine, x, vx, cellX), cellExitTime(engine, y, vy, cellY)), circle, eventCell);
+
+    for (int neighbourY = std::max(cellY - 1, 0); neighbourY <= std::min(cellY + 1, engine.cellsPerSide - 1); neighbourY++)
+    {
+        for (int neighbourX = std::max(cellX - 1, 0); neighbourX <= std::min(cellX + 1, engine.cellsPerSide - 1); neighbourX++)
+        {
+            for (int otherCircle : engine.cells[neighbourY * engine.cellsPerSide + neighbourX])
+            {
+                if (otherCircle == circle)
+                {
+                    continue;
+                }
+                pushEvent(engine, pairTime(engine, particles, circle, otherCircle, radius), circle, otherCircle);
+            }
+        }
+    }
+}
+
+inline void initEventEngine(EventEngine &engine, const ParticleStore &particles, float radius)
+{
+    int numCircles = particles.count;
+    engine.cellsPerSide = gridCellsPerSide(2.0f * radius, numCircles);
+    engine.cellSize = 2.0f / float(engine.cellsPerSide);
+    engine.cells.assign(size_t(engine.cellsPerSide) * size_t(engine.cellsPerSide), std::vector<int>());
+    engine.circleCell.resize(numCircles);
+    engine.cellSlot.resize(numCircles);
+    engine.circleTime.assign(numCircles, engine.now);
+    engine.collisionCount.assign(numCircles, 0);
+    engine.queue.clear();
+
+    for (int circle = 0; circle < numCircles; circle++)
+    {
+        int cell = eventCellCoordinate(engine, particles.y[circle]) * engine.cellsPerSide +
+                   eventCellCoordinate(engine, particles.x[circle]);
+        engine.circleCell[circle] = cell;
+        engine.cellSlot[circle] = (int)engine.cells[cell].size();
+        engine.cells[cell].push_back(circle);
+    }
+    for (int circle = 0; circle < numCircles; circle++)
+    {
+        predictEvents(engine, particles, circle, radius);
+    }
+    engine.compactSize = 2 * engine.queue.size() + 1024;
+    engine.initialized = true;
+}
+
+// drop the stale events whenever the queue has doubled since the last time,
+// so the cost of compacting stays proportional to the events pushed
+inline void compactEvents(EventEngine &engine)
+{
+    if (engine.queue.size() < engine.compactSize)
+    {
+        return;
+    }
+    engine.queue.erase(std::remove_if(engine.queue.begin(), engine.queue.end(),
+                                      [&](const CollisionEvent &event) { return eventIsStale(engine, event); }),
+                       engine.queue.end());
+    std::make_heap(engine.queue.begin(), engine.queue.end(), std::greater<CollisionEvent>());
+    engine.compactSize = 2 * engine.queue.size() + 1024;
+}
+
+// process every event up to duration steps from now, then move all circles to that time
+inline void advanceEvents(EventEngine &engine, ParticleStore &particles, float radius, float restitution,
+                          double duration)
+{
+    if (!engine.initialized || (int)engine.circleTime.size() != particles.count)
+    {
+        initEventEngine(engine, particles, radius);
+    }
+    double end = engine.now + duration;
+
+    while (!engine.queue.empty() && engine.queue.front().time <= end)
+    {
+        std::pop_heap(engine.queue.begin(), engine.queue.end(), std::greater<CollisionEvent>());
+        CollisionEvent event = engine.queue.back();
+        engine.queue.pop_back();
+        if (eventIsStale(engine, event))
+        {
+            continue;
+        }
+
+        engine.now = std::max(engine.now, event.time);
+        int circle = event.circle;
+        int otherCircle = event.otherCircle;
+        advanceCircle(engine, particles, circle);
+
+        // every event changes the speed or the cell of its circles, which makes all their pending events stale
+        engine.collisionCount[circle]++;
+
+        if (otherCircle == eventWallX)
+        {
+            particles.vx[circle] *= -1.0f;
+        }
+        else if (otherCircle == eventWallY)
+        {
+            particles.vy[circle] *= -1.0f;
+        }
+        else if (otherCircle == eventCell)
+        {
+            // step to the neighbouring cell the circle is heading for
+            int cellX = engine.circleCell[circle] % engine.cellsPerSide;
+            int cellY = engine.circleCell[circle] / engine.cellsPerSide;
+            float vx = particles.vx[circle];
+            float vy = particles.vy[circle];
+            if (cellExitTime(engine, particles.x[circle], vx, cellX) <= cellExitTime(engine, particles.y[circle], vy, cellY))
+            {
+                cellX += vx > 0.0f ? 1 : -1;
+            }
+            else
+            {
+                cellY += vy > 0.0f ? 1 : -1;
+            }
+            moveToCell(engine, circle, cellY * engine.cellsPerSide + cellX);
+        }
+        else
+        {
+            advanceCircle(engine, particles, otherCircle);
+
+            // the same impulse as resolveContacts, at the moment of contact
+            float normalX = particles.x[otherCircle] - particles.x[circle];
+            float normalY = particles.y[otherCircle] - particles.y[circle];
+            float length = std::sqrt(normalX * normalX + normalY * normalY);
+            normalX /= length;
+            normalY /= length;
+
+            float relativeX = particles.vx[otherCircle] - particles.vx[circle];
+            float relativeY = particles.vy[otherCircle] - particles.vy[circle];
+            float impulseMagnitude = (relativeX * normalX + relativeY * normalY) * (1.0f + restitution) / 2.0f;
+
+            particles.vx[circle] += impulseMagnitude * normalX;
+            particles.vy[circle] += impulseMagnitude * normalY;
+            particles.vx[otherCircle] -= impulseMagnitude * normalX;
+            particles.vy[otherCircle] -= impulseMagnitude * normalY;
+
+            engine.collisionCount[otherCircle]++;
+            predictEvents(engine, particles, otherCircle, radius);
+            engine.collisions++;
+        }
+
+        predictEvents(engine, particles, circle, radius);
+        compactEvents(engine);
+    }
+
+    engine.now = end;
+#pragma omp parallel for schedule(static)
+    for (int circle = 0; circle < particles.count; circle++)
+    {
+        advanceCircle(engine, particles, circle);
+    }
+}
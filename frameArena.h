@@ -0,0 +1,275 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Per-step scratch arenas
+// -----------------------
+// Lists that only live for one step (the contacts of every block, the
+// contacts of every pair of tiles) are carved out of a bump arena instead of
+// each keeping a std::vector of its own: every thread has its own arena, so
+// handing out memory is an addition without locks, and all of it is given back
+// at once when the arenas are reset at the start of the next contact search.
+//
+// An arena is one block of memory. When a step needs more, the rest comes from
+// extra heap blocks that are freed at the next reset. Which thread takes how
+// much of a step's work changes from step to step, so at the reset every
+// thread's block grows to the most any thread has needed in one step (the
+// high-water mark) plus half, not just the block of the thread that ran out.
+// After the first few steps the blocks fit every step and nothing is
+// allocated.
+
+const size_t arenaAlignment = 64;           // every allocation starts on its own cache line
+const size_t arenaMinimumBlock = 64 * 1024; // smallest heap block an arena allocates
+
+struct alignas(64) FrameArena
+{
+    char *buffer = NULL; // the main block
+    size_t capacity = 0;
+    size_t used = 0;
+
+    std::vector<char *> overflow; // extra blocks of this step, when the main block ran out
+    size_t overflowUsed = 0;      // of the last extra block
+    size_t overflowCapacity = 0;
+
+    size_t stepBytes = 0;     // handed out since the last reset
+    size_t highWater = 0;     // most bytes handed out in one step
+    long long heapBlocks = 0; // heap blocks allocated, main and extra
+
+    FrameArena() = default;
+    FrameArena(const FrameArena &) = delete;
+    FrameArena &operator=(const FrameArena &) = delete;
+
+    ~FrameArena()
+    {
+        for (char *block : overflow)
+        {
+            free(block);
+        }
+        free(buffer);
+    }
+};
+
+inline char *allocateArenaBlock(size_t bytes)
+{
+    return (char *)aligned_alloc(arenaAlignment, bytes);
+}
+
+inline void *arenaAllocate(FrameArena &arena, size_t bytes)
+{
+    bytes = (bytes + arenaAlignment - 1) & ~(arenaAlignment - 1);
+    arena.stepBytes += bytes;
+    if (arena.used + bytes <= arena.capacity)
+    {
+        void *memory = arena.buffer + arena.used;
+        arena.used += bytes;
+        return memory;
+    }
+
+    // out of room until the next reset
+    if (arena.overflow.empty() || arena.overflowUsed + bytes > arena.overflowCapacity)
+    {
+        arena.overflowCapacity = std::max(bytes, std::max(arena.capacity, arenaMinimumBlock));
+        arena.overflow.push_back(allocateArenaBlock(arena.overflowCapacity));
+        arena.overflowUsed = 0;
+        arena.heapBlocks++;
+    }
+    void *memory = arena.overflow.back() + arena.overflowUsed;
+    arena.overflowUsed += bytes;
+    return memory;
+}
+
+// extend the allocation at memory from oldBytes to newBytes where it is, when
+// it is the last one of the main block and there is room behind it
+inline bool arenaExtend(FrameArena &arena, void *memory, size_t oldBytes, size_t newBytes)
+{
+    oldBytes = (oldBytes + arenaAlignment - 1) & ~(arenaAlignment - 1);
+    newBytes = (newBytes + arenaAlignment - 1) & ~(arenaAlignment - 1);
+    if ((char *)memory + oldBytes != arena.buffer + arena.used || arena.used - oldBytes + newBytes > arena.capacity)
+    {
+        return false;
+    }
+    arena.used += newBytes - oldBytes;
+    arena.stepBytes += newBytes - oldBytes;
+    return true;
+}
+
+// give everything back; grow the main block when this step did not fit in it
+// or it is smaller than highWater, the most any arena needed in one step
+inline void resetArena(FrameArena &arena, size_t highWater)
+{
+    arena.highWater = std::max(arena.highWater, arena.stepBytes);
+    bool overflowed = !arena.overflow.empty();
+    for (char *block : arena.overflow)
+    {
+        free(block);
+    }
+    arena.overflow.clear();
+    if (overflowed || arena.capacity < highWater)
+    {
+        free(arena.buffer);
+        size_t capacity = highWater + highWater / 2;
+        arena.capacity = (capacity + arenaAlignment - 1) & ~(arenaAlignment - 1);
+        arena.buffer = allocateArenaBlock(arena.capacity);
+        arena.heapBlocks++;
+    }
+    arena.used = 0;
+    arena.stepBytes = 0;
+}
+
+// one arena per OpenMP thread
+struct FrameArenas
+{
+    std::vector<std::unique_ptr<FrameArena>> threads;
+};
+
+// reset every thread's arena, outside of any parallel region
+inline void resetFrameArenas(FrameArenas &arenas)
+{
+#ifdef _OPENMP
+    size_t numThreads = (size_t)omp_get_max_threads();
+#else
+    size_t numThreads = 1;
+#endif
+    while (arenas.threads.size() < numThreads)
+    {
+        arenas.threads.emplace_back(new FrameArena());
+    }
+    size_t highWater = 0;
+    for (const std::unique_ptr<FrameArena> &arena : arenas.threads)
+    {
+        highWater = std::max(highWater, std::max(arena->highWater, arena->stepBytes));
+    }
+    for (std::unique_ptr<FrameArena> &arena : arenas.threads)
+    {
+        resetArena(*arena, highWater);
+    }
+}
+
+// the arena of the calling thread
+inline FrameArena &threadArena(FrameArenas &arenas)
+{
+#ifdef _OPENMP
+    return *arenas.threads[omp_get_thread_num()];
+#else
+    return *arenas.threads[0];
+#endif
+}
+
+struct FrameArenaStats
+{
+    size_t highWater = 0; // sum of the high-water marks of all threads
+    size_t capacity = 0;  // sum of their main blocks
+    long long heapBlocks = 0;
+};
+
+inline void addArenaStats(FrameArenaStats &stats, const FrameArena &arena)
+{
+    stats.highWater += std::max(arena.highWater, arena.stepBytes);
+    stats.capacity += arena.capacity;
+    stats.heapBlocks += arena.heapBlocks;
+}
+
+inline FrameArenaStats frameArenaStats(const FrameArenas &arenas)
+{
+    FrameArenaStats stats;
+    for (const std::unique_ptr<FrameArena> &arena : arenas.threads)
+    {
+        addArenaStats(stats, *arena);
+    }
+    return stats;
+}
+
+// A growable array in an arena, for trivially copyable elements. It is only
+// valid until its arena is reset, and must then be cleared with reset() before
+// it is used again.
+template <typename T>
+struct ArenaArray
+{
+    static_assert(std::is_trivially_copyable<T>::value, "elements are moved with memcpy");
+
+    T *items = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+
+    // forget the memory, which belongs to an arena that was reset
+    void reset()
+    {
+        items = NULL;
+        count = 0;
+        capacity = 0;
+    }
+
+    void reserve(FrameArena &arena, size_t wanted)
+    {
+        if (wanted <= capacity)
+        {
+            return;
+        }
+        size_t grown = std::max(wanted, std::max(2 * capacity, arenaAlignment / sizeof(T)));
+        if (items == NULL || !arenaExtend(arena, items, capacity * sizeof(T), grown * sizeof(T)))
+        {
+            T *moved = (T *)arenaAllocate(arena, grown * sizeof(T));
+            if (count > 0)
+            {
+                memcpy(moved, items, count * sizeof(T));
+            }
+            items = moved;
+        }
+        capacity = grown;
+    }
+
+    void push_back(FrameArena &arena, const T &item)
+    {
+        if (count == capacity)
+        {
+            reserve(arena, count + 1);
+        }
+        items[count++] = item;
+    }
+
+    void resize(FrameArena &arena, size_t newCount)
+    {
+        reserve(arena, newCount);
+        count = newCount;
+    }
+
+    size_t size() const
+    {
+        return count;
+    }
+
+    T *begin()
+    {
+        return items;
+    }
+    T *end()
+    {
+        return items + count;
+    }
+    const T *begin() const
+    {
+        return items;
+    }
+    const T *end() const
+    {
+        return items + count;
+    }
+
+    T &operator[](size_t index)
+    {
+        return items[index];
+    }
+    const T &operator[](size_t index) const
+    {
+        return items[index];
+    }
+};
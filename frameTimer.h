@@ -0,0 +1,180 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+// Per-phase frame timing
+// ----------------------
+// Every phase of a frame is timed with the steady clock and counted in a
+// log-linear histogram (8 buckets per power of two, so any percentile is
+// within 12.5% of the true value) next to its exact count, sum and maximum.
+// A histogram is only written by one thread but may be read by another while
+// it is dumped, so the counters are relaxed atomics.
+
+enum FramePhase
+{
+    PhaseInput,
+    PhaseAttraction,
+    PhaseIntegrate,
+    PhaseCollisions,
+    PhaseVertexBuild,
+    PhaseUpload,
+    PhaseDraw,
+    PhaseSwap,
+    FramePhaseCount
+};
+
+const char *const framePhaseNames[FramePhaseCount] = {
+    "input", "attraction", "integrate", "collisions", "vertex_build", "buffer_upload", "draw_submission", "swap"};
+
+const int histogramSubBuckets = 8;
+const int histogramBuckets = 64 * histogramSubBuckets;
+
+struct PhaseHistogram
+{
+    std::atomic<uint64_t> buckets[histogramBuckets] = {};
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> totalNs{0};
+    std::atomic<uint64_t> maxNs{0};
+};
+
+struct FrameTimer
+{
+    PhaseHistogram phases[FramePhaseCount];
+};
+
+typedef std::chrono::steady_clock::time_point PhaseTime;
+
+inline PhaseTime phaseClock()
+{
+    return std::chrono::steady_clock::now();
+}
+
+inline int histogramBucket(uint64_t ns)
+{
+    if (ns < histogramSubBuckets)
+    {
+        return (int)ns;
+    }
+    // the top bit picks the power of two, the next three bits the sub bucket
+    int exponent = 63 - __builtin_clzll(ns);
+    int subBucket = (int)(ns >> (exponent - 3)) & (histogramSubBuckets - 1);
+    return (exponent - 2) * histogramSubBuckets + subBucket;
+}
+
+// largest value counted in a bucket
+inline uint64_t histogramBucketLimit(int bucket)
+{
+    if (bucket < histogramSubBuckets)
+    {
+        return bucket;
+    }
+    int exponent = bucket / histogramSubBuckets + 2;
+    uint64_t subBucket = bucket % histogramSubBuckets;
+    return ((histogramSubBuckets + subBucket + 1) << (exponent - 3)) - 1;
+}
+
+inline void addSample(PhaseHistogram &histogram, uint64_t ns)
+{
+    // a single writer per histogram, so load + store is enough
+    std::atomic<uint64_t> &bucket = histogram.buckets[histogramBucket(ns)];
+    bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    histogram.count.store(histogram.count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    histogram.totalNs.store(histogram.totalNs.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+    if (ns > histogram.maxNs.load(std::memory_order_relaxed))
+    {
+        histogram.maxNs.store(ns, std::memory_order_relaxed);
+    }
+}
+
+// count the time since start in phase and return the current time, so phases
+// can be chained; does nothing but read the clock when timer is NULL
+inline PhaseTime recordPhase(FrameTimer *timer, FramePhase phase, PhaseTime start)
+{
+    PhaseTime now = phaseClock();
+    if (timer != NULL)
+    {
+        addSample(timer->phases[phase], std::chrono::duration_cast<std::chrono::nanoseconds>(now - start).count());
+    }
+    return now;
+}
+
+inline uint64_t histogramPercentile(const PhaseHistogram &histogram, double percentile)
+{
+    uint64_t count = histogram.count.load(std::memory_order_relaxed);
+    uint64_t rank = (uint64_t)(percentile / 100.0 * count + 0.5);
+    uint64_t seen = 0;
+    for (int bucket = 0; bucket < histogramBuckets; bucket++)
+    {
+        seen += histogram.buckets[bucket].load(std::memory_order_relaxed);
+        if (seen >= rank && seen > 0)
+        {
+            // the bucket limit may overshoot the largest sample
+            return std::min(histogramBucketLimit(bucket), histogram.maxNs.load(std::memory_order_relaxed));
+        }
+    }
+    return histogram.maxNs.load(std::memory_order_relaxed);
+}
+
+// write every phase that has samples as JSON, or as CSV when path ends in .csv
+inline bool writeFrameTimings(const FrameTimer &timer, const std::string &path)
+{
+    std::ofstream file(path);
+    if (!file)
+    {
+        std::cout << "Failed to write timings to " << path << std::endl;
+        return false;
+    }
+
+    bool csv = path.size() >= 4 && path.compare(path.size() - 4, 4, ".csv") == 0;
+    if (csv)
+    {
+        file << "phase,count,mean_us,p50_us,p95_us,p99_us,max_us\n";
+    }
+    else
+    {
+        file << "{\n  \"phases\": {";
+    }
+
+    bool first = true;
+    for (int phase = 0; phase < FramePhaseCount; phase++)
+    {
+        const PhaseHistogram &histogram = timer.phases[phase];
+        uint64_t count = histogram.count.load(std::memory_order_relaxed);
+        if (count == 0)
+        {
+            continue;
+        }
+
+        double mean = histogram.totalNs.load(std::memory_order_relaxed) / 1000.0 / count;
+        double p50 = histogramPercentile(histogram, 50.0) / 1000.0;
+        double p95 = histogramPercentile(histogram, 95.0) / 1000.0;
+        double p99 = histogramPercentile(histogram, 99.0) / 1000.0;
+        double max = histogram.maxNs.load(std::memory_order_relaxed) / 1000.0;
+
+        if (csv)
+        {
+            file << framePhaseNames[phase] << "," << count << "," << mean << "," << p50 << "," << p95 << ","
+                 << p99 << "," << max << "\n";
+        }
+        else
+        {
+            file << (first ? "\n" : ",\n") << "    \"" << framePhaseNames[phase] << "\": {\"count\": " << count
+                 << ", \"mean_us\": " << mean << ", \"p50_us\": " << p50 << ", \"p95_us\": " << p95
+                 << ", \"p99_us\": " << p99 << ", \"max_us\": " << max << "}";
+        }
+        first = false;
+    }
+
+    if (!csv)
+    {
+        file << "\n  }\n}\n";
+    }
+    return true;
+}
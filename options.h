@@ -0,0 +1,408 @@
+#pragma once
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+// Command line options shared by hello_Circle.cpp and parallelVersion.cpp
+// ------------------------------------------------------------------------
+enum class EngineMode
+{
+    Step, // move every circle each step, then find and resolve overlaps
+    Event // jump from one predicted wall or circle collision to the next
+};
+
+enum class BroadphaseMode
+{
+    BruteForce,    // compare every circle with every later circle
+    Grid,          // uniform grid, only neighbouring cells are compared
+    SweepAndPrune, // circles kept sorted along x, only overlapping x ranges are compared
+    Verlet,        // per-circle neighbor lists with a skin, rebuilt only when circles moved far enough
+    Tiled          // all pairs, in cache-sized tiles with SIMD distance tests
+};
+
+enum class SolverMode
+{
+    Sequential, // one pass over the contacts in order, like the original loop
+    Colored     // contacts colored so each color is resolved in parallel, repeated a few times
+};
+
+enum class BoundaryMode
+{
+    Reflect, // circles bounce off the screen edges
+    Wrap     // circles leave at one edge and come back in at the opposite one
+};
+
+enum class PrecisionMode
+{
+    Float, // contact normals and impulses in single precision, like the original loop
+    Double // the same in double precision; the positions and speeds stay floats
+};
+
+enum class RenderMode
+{
+    Fan,       // one CPU-tessellated triangle fan and draw call per circle
+    Instanced, // one shared unit circle drawn once per circle center
+    Sdf        // one quad per circle center, the circle is shaded in the fragment shader
+};
+
+enum class UploadMode
+{
+    Copy,      // orphan the buffer and copy the frame into it with glBufferSubData
+    Persistent // write straight into a persistently mapped, fenced ring buffer
+};
+
+struct Options
+{
+    int numCircles = 0;
+    unsigned long long seed = 1; // the scene only depends on the seed
+    EngineMode engine = EngineMode::Step;
+    BroadphaseMode broadphase = BroadphaseMode::Grid;
+    double skin = 0.5;       // Verlet list skin, in radii
+    int reorderInterval = 0; // steps between Morton reorders of the circle storage, 0 for never
+    SolverMode solver = SolverMode::Sequential;
+    int solverIterations = 4; // sweeps of the colored solver
+    double attraction = 0.0;  // strength of the pull between circles, 0 for none
+    double theta = 0.5;       // Barnes-Hut opening angle
+    double restitution = 1.0; // share of the approach speed that is kept in a collision, 1 for elastic
+    BoundaryMode boundary = BoundaryMode::Reflect;
+    PrecisionMode precision = PrecisionMode::Float;
+    RenderMode render = RenderMode::Instanced;
+    UploadMode upload = UploadMode::Persistent;
+
+    bool headless = false; // simulate without a window or GL context
+    int steps = 1000;      // steps to simulate in headless mode
+
+    bool physicsThread = false;     // step the physics on its own thread
+    double timestep = 1.0 / 60.0;   // seconds per physics step on that thread
+
+    std::string scenePath;      // start from the circles in this scene file instead of a random scene
+    std::string restorePath;    // continue from this checkpoint instead of a random scene
+    std::string checkpointPath; // write a checkpoint here at exit
+    int checkpointInterval = 0; // and every this many steps when positive
+
+    std::string replayPath;    // play this trajectory back instead of simulating
+    long long replayStart = 0; // from this frame
+
+    std::string recordPath; // record the circle positions to this trajectory file
+    int recordInterval = 1; // every this many steps
+
+    std::string timingsPath;      // per-phase timings are written here at exit (JSON, or CSV for *.csv)
+    double timingsInterval = 0.0; // also rewrite them every this many seconds when positive
+};
+
+inline void printUsage(const char *program)
+{
+    std::cout << "Usage: " << program << " <number of circles> [options]\n"
+              << "       " << program << " --scene FILE [options]\n"
+              << "       " << program << " --restore FILE [options]\n"
+              << "       " << program << " --replay FILE [options]\n"
+              << "  --seed N                    seed of the random scene (default: 1)\n"
+              << "  --engine step|event         fixed steps or event-driven collisions (default: step)\n"
+              << "  --broadphase MODE           broadphase: brute, grid, sap, verlet or tiled (default: grid)\n"
+              << "  --skin F                    Verlet list skin in radii (default: 0.5)\n"
+              << "  --reorder-interval K        sort the circle storage in Morton order every K steps\n"
+              << "  --solver sequential|colored contact solver (default: sequential)\n"
+              << "  --solver-iterations N       sweeps of the colored solver (default: 4)\n"
+              << "  --attraction G              pull between circles, G / distance^2 per step, step engine only (default: 0)\n"
+              << "  --theta T                   Barnes-Hut opening angle of the attraction (default: 0.5)\n"
+              << "  --restitution E             restitution of the collisions, 0 to 1, below 1 step engine only (default: 1)\n"
+              << "  --boundary reflect|wrap     what the screen edges do to circles (default: reflect)\n"
+              << "  --precision float|double    precision of the contact impulses (default: float)\n"
+              << "  --render fan|instanced|sdf  circle rendering (default: instanced)\n"
+              << "  --upload copy|persistent    per-frame buffer upload (default: persistent)\n"
+              << "  --headless                  simulate without a window and print the timing\n"
+              << "  --steps N                   steps to simulate in headless mode (default: 1000)\n"
+              << "  --physics-thread            step the physics on its own thread at a fixed timestep\n"
+              << "  --timestep S                seconds per physics step (default: 0.0166667)\n"
+              << "  --scene FILE                start from a binary or CSV scene file instead of a random scene\n"
+              << "  --restore FILE              continue from a checkpoint instead of a random scene\n"
+              << "  --checkpoint FILE           write a checkpoint at exit\n"
+              << "  --checkpoint-interval N     also write it every N steps\n"
+              << "  --record FILE               record the circle positions to a compressed trajectory file\n"
+              << "  --record-interval N         record every N steps (default: 1)\n"
+              << "  --replay FILE               play a recorded trajectory back instead of simulating\n"
+              << "  --replay-start N            start the replay at frame N (default: 0)\n"
+              << "  --timings FILE              write per-phase timing percentiles at exit (.json or .csv)\n"
+              << "  --timings-interval S        also rewrite the timings every S seconds" << std::endl;
+}
+
+// a positive whole number
+inline bool parsePositive(const char *text, int &number)
+{
+    // validate the input is a number
+    if (text == NULL || !isdigit(*text) || atoi(text) < 1)
+    {
+        return false;
+    }
+    number = atoi(text);
+    return true;
+}
+
+// returns false (after printing the usage) when the command line is invalid
+inline bool parseOptions(int argc, char **argv, Options &options)
+{
+    // should read how many circles to draw from command line, unless they come from a scene or checkpoint
+    int firstOption = 1;
+    if (argc >= 2 && strncmp(argv[1], "--", 2) != 0)
+    {
+        if (!parsePositive(argv[1], options.numCircles))
+        {
+            printUsage(argv[0]);
+            return false;
+        }
+        firstOption = 2;
+    }
+
+    for (int arg = firstOption; arg < argc; arg++)
+    {
+        const char *value = arg + 1 < argc ? argv[arg + 1] : NULL;
+
+        if (strcmp(argv[arg], "--seed") == 0 && value != NULL && isdigit(*value))
+        {
+            options.seed = strtoull(value, NULL, 10);
+            arg++;
+        }
+        else if (strcmp(argv[arg], "--engine") == 0 && value != NULL)
+        {
+            if (strcmp(value, "step") == 0)
+                options.engine = EngineMode::Step;
+            else if (strcmp(value, "event") == 0)
+                options.engine = EngineMode::Event;
+            else
+            {
+                printUsage(argv[0]);
+                return false;
+            }
+            arg++;
+        }
+        else if (strcmp(argv[arg], "--broadphase") == 0 && value != NULL)
+        {
+            if (strcmp(value, "brute") == 0)
+                options.broadphase = BroadphaseMode::BruteForce;
+            else if (strcmp(value, "grid") == 0)
+                options.broadphase = BroadphaseMode::Grid;
+            else if (strcmp(value, "sap") == 0)
+                options.broadphase = BroadphaseMode::SweepAndPrune;
+            else if (strcmp(value, "verlet") == 0)
+                options.broadphase = BroadphaseMode::Verlet;
+            else if (strcmp(value, "tiled") == 0)
+                options.broadphase = BroadphaseMode::Tiled;
+            else
+            {
+                printUsage(argv[0]);
+                return false;
+            }
+            arg++;
+        }
+        else if (strcmp(argv[arg], "--skin") == 0 && value != NULL && atof(value) > 0.0)
+        {
+            options.skin = atof(value);
+            arg++;
+        }
+        else if (strcmp(argv[arg], "--reorder-interval") == 0 && parsePositive(value, options.reorderInterval))
+        {
+            arg++;
+        }
+        else if (strcmp(argv[arg], "--solver") == 0 && value != NULL)
+        {
+            if (strcmp(value, "sequential") == 0)
+                options.solver = SolverMode::Sequential;
+            else if (strcmp(value, "colored") == 0)
+                options.solver = SolverMode::Colored;
+            else
+            {
+                printUsage(argv[0]);
+                return false;
+            }
+            arg++;
+        }
+        else if (strcmp(argv[arg], "--solver-iterations") == 0 && parsePositive(value, options.solverIterations))
+        {
+            arg++;
+        }
+        else if (strcmp(argv[arg], "--attraction") == 0 && value != NULL && atof(value) >= 0.0)
+        {
+            options.attraction = atof(value);
+            arg++;
+        }
+        else if (strcmp(argv[arg], "--theta") == 0 && value != NULL && atof(value) >= 0.0)
+        {
+            options.theta = atof(value);
+            arg++;
+        }
+        else if (strcmp(argv[arg], "--restitution") == 0 && value != NULL && atof(value) >= 0.0 &&
+                 atof(value) <= 1.0)
+        {
+            options.restitution = atof(value);
+            arg++;
+        }
+        else if (strcmp(argv[arg], "--boundary") == 0 && value != NULL)
+        {
+            if (strcmp(value, "reflect") == 0)
+                options.boundary = BoundaryMode::Reflect;
+            else if (strcmp(value, "wrap") == 0)
+                options.boundary = BoundaryMode::Wrap;
+            else
+            {
+                printUsage(argv[0]);
+                return false;
+            }
+            arg++;
+        }
+        else if (strcmp(argv[arg], "--precision") == 0 && value != NULL)
+        {
+            if (strcmp(value, "float") == 0)
+                options.precision = PrecisionMode::Float;
+            else if (strcmp(value, "double") == 0)
+                options.precision = PrecisionMode::Double;
+            else
+            {
+                printUsage(argv[0]);
+                return false;
+            }
+            arg++;
+        }
+        else if (strcmp(argv[arg], "--render") == 0 && value != NULL)
+        {
+            if (strcmp(value, "fan") == 0)
+                options.render = RenderMode::Fan;
+            else if (strcmp(value, "instanced") == 0)
+                options.render = RenderMode::Instanced;
+            else if (strcmp(value, "sdf") == 0)
+                options.render = RenderMode::Sdf;
+            else
+            {
+                printUsage(argv[0]);
+                return false;
+            }
+            arg++;
+        }
+        else if (strcmp(argv[arg], "--upload") == 0 && value != NULL)
+        {
+            if (strcmp(value, "copy") == 0)
+                options.upload = UploadMode::Copy;
+            else if (strcmp(value, "persistent") == 0)
+                options.upload = UploadMode::Persistent;
+            else
+            {
+                printUsage(argv[0]);
+                return false;
+            }
+            arg++;
+        }
+        else if (strcmp(argv[arg], "--headless") == 0)
+        {
+            options.headless = true;
+        }
+        else if (strcmp(argv[arg], "--steps") == 0 && parsePositive(value, options.steps))
+        {
+            arg++;
+        }
+        else if (strcmp(argv[arg], "--physics-thread") == 0)
+        {
+            options.physicsThread = true;
+        }
+        else if (strcmp(argv[arg], "--timestep") == 0 && value != NULL && atof(value) > 0.0)
+        {
+            options.timestep = atof(value);
+            arg++;
+        }
+        else if (strcmp(argv[arg], "--scene") == 0 && value != NULL)
+        {
+            options.scenePath = value;
+            arg++;
+        }
+        else if (strcmp(argv[arg], "--restore") == 0 && value != NULL)
+        {
+            options.restorePath = value;
+            arg++;
+        }
+        else if (strcmp(argv[arg], "--checkpoint") == 0 && value != NULL)
+        {
+            options.checkpointPath = value;
+            arg++;
+        }
+        else if (strcmp(argv[arg], "--checkpoint-interval") == 0 && parsePositive(value, options.checkpointInterval))
+        {
+            arg++;
+        }
+        else if (strcmp(argv[arg], "--record") == 0 && value != NULL)
+        {
+            options.recordPath = value;
+            arg++;
+        }
+        else if (strcmp(argv[arg], "--record-interval") == 0 && parsePositive(value, options.recordInterval))
+        {
+            arg++;
+        }
+        else if (strcmp(argv[arg], "--replay") == 0 && value != NULL)
+        {
+            options.replayPath = value;
+            arg++;
+        }
+        else if (strcmp(argv[arg], "--replay-start") == 0 && value != NULL && isdigit(*value))
+        {
+            options.replayStart = strtoll(value, NULL, 10);
+            arg++;
+        }
+        else if (strcmp(argv[arg], "--timings") == 0 && value != NULL)
+        {
+            options.timingsPath = value;
+            arg++;
+        }
+        else if (strcmp(argv[arg], "--timings-interval") == 0 && value != NULL && atof(value) > 0.0)
+        {
+            options.timingsInterval = atof(value);
+            arg++;
+        }
+        else
+        {
+            printUsage(argv[0]);
+            return false;
+        }
+    }
+
+    if (options.numCircles == 0 && options.scenePath.empty() && options.restorePath.empty() &&
+        options.replayPath.empty())
+    {
+        printUsage(argv[0]);
+        return false;
+    }
+    if (options.checkpointInterval > 0 && options.checkpointPath.empty())
+    {
+        printUsage(argv[0]);
+        return false;
+    }
+    // a replay does not step, so there is nothing to record, to checkpoint (the
+    // recording has no speeds) or to step on a thread
+    if (!options.replayPath.empty() &&
+        (!options.recordPath.empty() || !options.checkpointPath.empty() || options.physicsThread))
+    {
+        printUsage(argv[0]);
+        return false;
+    }
+    // the event engine predicts bounces off the edges, it has no wrapped screen
+    if (options.boundary == BoundaryMode::Wrap && options.engine == EngineMode::Event)
+    {
+        printUsage(argv[0]);
+        return false;
+    }
+    // nor any pull, since it moves the circles in straight lines between events
+    if (options.attraction > 0.0 && options.engine == EngineMode::Event)
+    {
+        printUsage(argv[0]);
+        return false;
+    }
+    // and only elastic collisions: after an inelastic one the touching pair can
+    // still approach by a rounding error and collide again at the same time
+    if (options.restitution < 1.0 && options.engine == EngineMode::Event)
+    {
+        printUsage(argv[0]);
+        return false;
+    }
+
+    return true;
+}
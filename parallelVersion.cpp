@@ -6,6 +6,12 @@
 #include <ctime>
 #include <glm/glm.hpp>
 #include <omp.h>
+#include <memory>
+
+#include "options.h"
+#include "simulation.h"
+#include "physicsThread.h"
+#include "circleRenderer.h"
 
 void framebuffer_size_callback(GLFWwindow *window, int width, int height);
 void processInput(GLFWwindow *window);
@@ -14,69 +20,87 @@ void processInput(GLFWwindow *window);
 const unsigned int SCR_WIDTH = 800;
 const unsigned int SCR_HEIGHT = 600;
 
-const char *vertexShaderSource = "#version 330 core\n"
-                                 "layout (location = 0) in vec3 aPos;\n"
-                                 "void main()\n"
-                                 "{\n"
-                                 "   gl_Position = vec4(aPos.x, aPos.y, aPos.z, 1.0);\n"
-                                 "}\0";
-const char *fragmentShaderSource = R"(
-#version 330 core
-out vec4 FragColor;
-
-void main()
-{
-    // Define the center and radius of the bubble
-    vec2 center = vec2(0.5, 0.5);
-    float radius = 0.5;
-
-    // Calculate the distance from the fragment to the center
-    vec2 fragPos = gl_FragCoord.xy / 800.0; // Assuming a resolution of 800x600
-    float distance = length(fragPos - center);
-
-    // Define bubble colors
-    vec3 bubbleColor = vec3(0.5, 0.5, 1.0); // Bubble color (blue)
-
-    // Add a shimmering effect based on distance and time
-    float shimmer = 0.1 * sin(distance * 20.0 + 2.0 * 3.14159265359 * gl_FragCoord.x / 800.0);
-
-    // Combine the bubble color and shimmer effect
-    vec3 finalColor = bubbleColor + vec3(shimmer);
-
-    // Set the alpha value based on distance from the center
-    float alpha = smoothstep(radius - 0.02, radius + 0.02, distance);
-
-    // Add transparency to the bubble
-    alpha *= 0.5; // You can adjust this value for the desired level of transparency
-
-    FragColor = vec4(finalColor, alpha);
-}
-)";
-
 int main(int argc, char **argv)
 {
-    // should read how many circles to draw from command line
-    if (argc != 2)
+    Options options;
+    if (!parseOptions(argc, argv, options))
     {
-        std::cout << "Usage: " << argv[0] << " <number of circles>" << std::endl;
         return -1;
     }
 
-    // validate the input is a number
+    std::cout << "Threads: " << omp_get_max_threads() << std::endl;
 
-    if (!isdigit(*argv[1]))
+    // set up the circles
+    // ------------------
+    const float radius = 0.10f;
+    const float restitution = float(options.restitution);
+
+    Simulation simulation;
+    TrajectoryReplay replay;
+    if (!options.replayPath.empty())
     {
-        std::cout << "Usage: " << argv[0] << " <number of circles>" << std::endl;
-        return -1;
+        if (!loadReplay(simulation, replay, options, options.replayPath, restitution))
+        {
+            return -1;
+        }
     }
+    else if (!options.restorePath.empty())
+    {
+        if (!restoreCheckpoint(simulation, options, options.restorePath))
+        {
+            return -1;
+        }
+    }
+    else if (!options.scenePath.empty())
+    {
+        if (!loadScene(simulation, options, options.scenePath, radius, restitution))
+        {
+            return -1;
+        }
+    }
+    else
+    {
+        createScene(simulation, options, radius, restitution);
+    }
+    int numCircles = simulation.particles.count;
 
-    if (atoi(argv[1]) < 1)
+    // per-phase timings, only collected when they are written somewhere
+    std::unique_ptr<FrameTimer> timer;
+    if (!options.timingsPath.empty())
+    {
+        timer.reset(new FrameTimer());
+        simulation.timer = timer.get();
+    }
+
+    // trajectory recording, written out by a thread of its own
+    TrajectoryRecorder recorder;
+    if (!options.recordPath.empty() &&
+        !startRecording(simulation, recorder, options.recordPath, options.recordInterval))
     {
-        std::cout << "Usage: " << argv[0] << " <number of circles>" << std::endl;
         return -1;
     }
 
-    int numCircles = atoi(argv[1]);
+    if (options.headless)
+    {
+        if (!options.replayPath.empty())
+        {
+            runReplayHeadless(replay, simulation.particles, options.replayStart);
+        }
+        else
+        {
+            runHeadless(simulation, options.steps);
+        }
+        stopTrajectoryRecorder(recorder);
+        if (!options.checkpointPath.empty())
+        {
+            saveCheckpoint(simulation, options.checkpointPath);
+        }
+        if (timer)
+        {
+            writeFrameTimings(*timer, options.timingsPath);
+        }
+        return 0;
+    }
 
     // glfw: initialize and configure
     // ------------------------------
@@ -112,119 +136,29 @@ int main(int argc, char **argv)
         return -1;
     }
 
-    // build and compile our shader program
-    // ------------------------------------
-    // vertex shader
-    unsigned int vertexShader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertexShader, 1, &vertexShaderSource, NULL);
-    glCompileShader(vertexShader);
-    // check for shader compile errors
-    int success;
-    char infoLog[512];
-    glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &success);
-    if (!success)
-    {
-        glGetShaderInfoLog(vertexShader, 512, NULL, infoLog);
-        std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n"
-                  << infoLog << std::endl;
-    }
-    // fragment shader
-    unsigned int fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragmentShader, 1, &fragmentShaderSource, NULL);
-    glCompileShader(fragmentShader);
-    // check for shader compile errors
-    glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &success);
-    if (!success)
-    {
-        glGetShaderInfoLog(fragmentShader, 512, NULL, infoLog);
-        std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n"
-                  << infoLog << std::endl;
-    }
-    // link shaders
-    unsigned int shaderProgram = glCreateProgram();
-    glAttachShader(shaderProgram, vertexShader);
-    glAttachShader(shaderProgram, fragmentShader);
-    glLinkProgram(shaderProgram);
-    // check for linking errors
-    glGetProgramiv(shaderProgram, GL_LINK_STATUS, &success);
-    if (!success)
-    {
-        glGetProgramInfoLog(shaderProgram, 512, NULL, infoLog);
-        std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n"
-                  << infoLog << std::endl;
-    }
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
-
     // set up vertex data (and buffer(s)) and configure vertex attributes
     // ------------------------------------------------------------------
-    const float radius = 0.10f;
     const int segments = 360; // Number of triangle fan segments
 
-    glm::vec2 *circlePositions = new glm::vec2[numCircles];
-
-    const int spaceForVertices = 3 * (segments + 2); // (x, y, z) for each vertex
-
-    // Calculate vertices for the circle
-    float *vertices = new float[spaceForVertices * numCircles]; // (x, y, z) for each vertex
+    CircleRenderer renderer;
+    initCircleRenderer(renderer, options.render, options.upload, numCircles, segments, simulation.radius);
 
-    for (int circle = 0; circle < numCircles; circle++)
+    // with a physics thread the render loop only draws interpolated snapshots
+    PhysicsThread physics;
+    ParticleStore interpolated;
+    if (options.physicsThread)
     {
-        float theta = 1.50f * 3.1415926f * float(circle) / float(numCircles);
-        int offset = spaceForVertices * circle; // Start from index 3
-
-        float centerX = 2.0f * (float)rand() / (float)RAND_MAX - 1.0f;
-        float centerY = 2.0f * (float)rand() / (float)RAND_MAX - 1.0f;
-
-        circlePositions[circle].x = centerX;
-        circlePositions[circle].y = centerY;
-
-        vertices[offset] = centerX;
-        vertices[offset + 1] = centerY;
-        vertices[offset + 2] = 0.0f;
-
-        for (int i = 0; i <= segments; ++i)
-        {
-            float theta = 2.0f * 3.1415926f * float(i) / float(segments);
-            int offset = spaceForVertices * circle + 3 * (i + 1); // Start from index 3
-
-            vertices[offset] = centerX + radius * cos(theta);
-            vertices[offset + 1] = centerY + radius * sin(theta);
-            vertices[offset + 2] = 0.0f;
-        }
+        allocateParticles(interpolated, numCircles);
+        startPhysicsThread(physics, simulation, options.timestep);
     }
 
-    unsigned int VBO, VAO;
-    glGenVertexArrays(1, &VAO);
-    glGenBuffers(1, &VBO);
-    // bind the Vertex Array Object first, then bind and set vertex buffer(s), and then configure vertex attributes(s).
-    glBindVertexArray(VAO);
-
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * spaceForVertices * numCircles, vertices, GL_STATIC_DRAW);
-
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void *)0);
-    glEnableVertexAttribArray(0);
-
-    // note that this is allowed, the call to glVertexAttribPointer registered VBO as the vertex attribute's bound vertex buffer object so afterwards we can safely unbind
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-
     // render loop
     // -----------
-    std::vector<glm::vec2> circleSpeeds(numCircles);
-
-    // Initialize speeds for each circle (you can set different initial speeds)
-    for (int circle = 0; circle < numCircles; circle++)
-    {
-        float initialSpeedX = 0.0005f;
-        float initialSpeedY = 0.0005f;
-        circleSpeeds[circle] = glm::vec2(initialSpeedX, initialSpeedY);
-    }
-
     int frameCount = 0;
     double lastTime = glfwGetTime();
     double deltaTime = 0.0;
-    double restitution = 1.0f;
+    double lastTimingsDump = lastTime;
+
     while (!glfwWindowShouldClose(window))
     {
 
@@ -248,97 +182,75 @@ int main(int argc, char **argv)
             deltaTime = 0.0;
         }
 
+        // Write the timings so far at a regular interval, if requested
+        if (timer && options.timingsInterval > 0.0 && currentTime - lastTimingsDump >= options.timingsInterval)
+        {
+            writeFrameTimings(*timer, options.timingsPath);
+            lastTimingsDump = currentTime;
+        }
+
+        PhaseTime phaseStart = phaseClock();
         processInput(window);
+        phaseStart = recordPhase(timer.get(), PhaseInput, phaseStart);
 
         glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT);
 
-        // Update the time for animation
-        float time = glfwGetTime();
-
-        glUseProgram(shaderProgram);
-        glUniform1f(glGetUniformLocation(shaderProgram, "time"), time); // Pass time to the shader
-
-        glBindVertexArray(VAO);
-
-// Update circle positions and buffer data
-        for (int circle = 0; circle < numCircles; circle++)
+        // Move the circles and resolve their collisions
+        if (!options.replayPath.empty())
         {
-            circlePositions[circle].x += circleSpeeds[circle].x; // Adjust the movement speed as needed
-            circlePositions[circle].y += circleSpeeds[circle].y; // Adjust the movement speed as needed
-
-            // Check if the circle reaches the screen boundaries
-            if (circlePositions[circle].x > 1.0f - radius || circlePositions[circle].x < -1.0f + radius)
-            {
-                // Reverse the x-direction to simulate bounce
-                circleSpeeds[circle].x *= -1.0f;
-            }
-            if (circlePositions[circle].y > 1.0f - radius || circlePositions[circle].y < -1.0f + radius)
-            {
-                // Reverse the y-direction to simulate bounce
-                circleSpeeds[circle].y *= -1.0f;
-            }
-
-            // Check for collisions with other circles
-            for (int otherCircle = circle + 1; otherCircle < numCircles; otherCircle++)
-            {
-                float distance = glm::distance(circlePositions[circle], circlePositions[otherCircle]);
-                if (distance < 2.0f * radius)
-                {
-                    // Calculate the normal vector of the collision
-                    glm::vec2 normal = glm::normalize(circlePositions[otherCircle] - circlePositions[circle]);
-
-                    // Calculate the relative velocity of the circles
-                    glm::vec2 relativeVelocity = circleSpeeds[otherCircle] - circleSpeeds[circle];
-
-                    // Calculate the impulse magnitude
-                    float impulseMagnitude = glm::dot(relativeVelocity, normal) * (1.0f + restitution) / 2.0f;
-
-                    // Apply the impulse to the circles
-                    circleSpeeds[circle] += impulseMagnitude * normal;
-                    circleSpeeds[otherCircle] -= impulseMagnitude * normal;
-                }
-            }
-
-            // Update the buffer data with the new positions
-            int offset = spaceForVertices * circle;
-            vertices[offset] = circlePositions[circle].x;
-            vertices[offset + 1] = circlePositions[circle].y;
-            vertices[offset + 2] = 0.0f;
-
-            for (int i = 0; i <= segments; ++i)
-            {
-                float theta = 2.0f * 3.1415926f * float(i) / float(segments);
-                int offset = spaceForVertices * circle + 3 * (i + 1); // Start from index 3
-
-                vertices[offset] = circlePositions[circle].x + radius * cos(theta);
-                vertices[offset + 1] = circlePositions[circle].y + radius * sin(theta);
-                vertices[offset + 2] = 0.0f;
-            }
+            // show the next recorded frame, the arrow keys skip a keyframe interval per frame
+            long long frame = replay.frame + 1;
+            if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS)
+                frame += replay.header.keyframeInterval;
+            if (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS)
+                frame = replay.frame - replay.header.keyframeInterval;
+            if (!showTrajectoryFrame(replay, simulation.particles, frame))
+                glfwSetWindowShouldClose(window, true);
+            phaseStart = recordPhase(timer.get(), PhaseIntegrate, phaseStart);
         }
-
-        // Update the buffer data
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(float) * spaceForVertices * numCircles, vertices, GL_STATIC_DRAW);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-// Render circles
-        for (int circle = 0; circle < numCircles; circle++)
+        else if (options.physicsThread)
+        {
+            interpolatePhysics(physics, interpolated, physicsClock());
+        }
+        else
         {
-            glDrawArrays(GL_TRIANGLE_FAN, circle * (segments + 2), segments + 2);
+            // integrate and collisions are timed inside the step
+            stepSimulation(simulation);
+            phaseStart = phaseClock();
         }
 
+        // Update the buffer data with the new positions
+        buildCircleData(renderer, options.physicsThread ? interpolated : simulation.particles);
+        phaseStart = recordPhase(timer.get(), PhaseVertexBuild, phaseStart);
+        uploadCircleData(renderer);
+        phaseStart = recordPhase(timer.get(), PhaseUpload, phaseStart);
+
+        // Render circles
+        drawCircles(renderer, glfwGetTime());
+        phaseStart = recordPhase(timer.get(), PhaseDraw, phaseStart);
+
         glfwSwapBuffers(window);
         glfwPollEvents();
+        recordPhase(timer.get(), PhaseSwap, phaseStart);
+    }
+
+    stopPhysicsThread(physics);
+    stopTrajectoryRecorder(recorder);
+
+    if (!options.checkpointPath.empty())
+    {
+        saveCheckpoint(simulation, options.checkpointPath);
+    }
+
+    if (timer)
+    {
+        writeFrameTimings(*timer, options.timingsPath);
     }
 
     // optional: de-allocate all resources once they've outlived their purpose:
     // ------------------------------------------------------------------------
-    glDeleteVertexArrays(1, &VAO);
-    glDeleteBuffers(1, &VBO);
-    glDeleteProgram(shaderProgram);
-
-    delete[] vertices;
+    destroyCircleRenderer(renderer);
 
     // glfw: terminate, clearing all previously allocated GLFW resources.
     // ------------------------------------------------------------------
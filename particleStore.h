@@ -0,0 +1,274 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+
+#include <sys/mman.h>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+// Structure-of-arrays storage for the circles
+// -------------------------------------------
+// x, y, vx and vy live in separate arrays carved out of one 64-byte aligned
+// block, so the kernels below can load 8 circles per AVX2 register. Every
+// array is padded to whole cache lines; the padding is kept at zero. The block
+// is either allocated here or a private mapping of a checkpoint file.
+const int particleLanes = 8;
+const size_t particleAlignment = 64;
+
+struct ParticleStore
+{
+    int count = 0;
+    int capacity = 0; // padded length of each array
+
+    float *x = NULL;
+    float *y = NULL;
+    float *vx = NULL;
+    float *vy = NULL;
+
+    void *block = NULL;
+    void *mapping = NULL;    // when the arrays live in a file mapping, its start
+    size_t mappingBytes = 0; // and length
+
+    ParticleStore() = default;
+    ParticleStore(const ParticleStore &) = delete;
+    ParticleStore &operator=(const ParticleStore &) = delete;
+
+    ParticleStore(ParticleStore &&other) noexcept
+    {
+        *this = std::move(other);
+    }
+
+    ParticleStore &operator=(ParticleStore &&other) noexcept
+    {
+        std::swap(count, other.count);
+        std::swap(capacity, other.capacity);
+        std::swap(x, other.x);
+        std::swap(y, other.y);
+        std::swap(vx, other.vx);
+        std::swap(vy, other.vy);
+        std::swap(block, other.block);
+        std::swap(mapping, other.mapping);
+        std::swap(mappingBytes, other.mappingBytes);
+        return *this;
+    }
+
+    ~ParticleStore()
+    {
+        releaseBlock();
+    }
+
+    void releaseBlock()
+    {
+        if (mapping != NULL)
+        {
+            munmap(mapping, mappingBytes);
+        }
+        else
+        {
+            free(block);
+        }
+        block = NULL;
+        mapping = NULL;
+        mappingBytes = 0;
+    }
+};
+
+inline int paddedParticleCount(int count)
+{
+    // keep every array a whole number of cache lines so the next one stays aligned
+    const int lanesPerLine = int(particleAlignment / sizeof(float));
+    return (count + lanesPerLine - 1) / lanesPerLine * lanesPerLine;
+}
+
+// (re)allocate zeroed storage for count circles
+inline void allocateParticles(ParticleStore &particles, int count)
+{
+    int capacity = paddedParticleCount(count);
+    size_t arrayBytes = sizeof(float) * capacity;
+
+    particles.releaseBlock();
+    particles.block = aligned_alloc(particleAlignment, 4 * arrayBytes > 0 ? 4 * arrayBytes : particleAlignment);
+
+    // zeroed in parallel, so on multi-socket machines the pages land next to the threads that use them
+    const size_t chunkBytes = 1 << 16;
+    long long numChunks = (long long)((4 * arrayBytes + chunkBytes - 1) / chunkBytes);
+#pragma omp parallel for schedule(static)
+    for (long long chunk = 0; chunk < numChunks; chunk++)
+    {
+        size_t offset = chunk * chunkBytes;
+        memset((char *)particles.block + offset, 0, std::min(chunkBytes, 4 * arrayBytes - offset));
+    }
+
+    particles.count = count;
+    particles.capacity = capacity;
+    particles.x = (float *)particles.block;
+    particles.y = particles.x + capacity;
+    particles.vx = particles.y + capacity;
+    particles.vy = particles.vx + capacity;
+}
+
+// What happens to a circle whose center is past lower or upper on one axis.
+// A policy is a compile-time parameter of the kernel below, so each one gets
+// a loop of its own without a runtime test.
+
+// the circle bounces: its speed on that axis reverses, a sign flip selected by
+// a compare mask instead of a branch, with the same result as `speed *= -1.0f`
+struct ReflectBoundary
+{
+    static const bool movesPosition = false;
+    static const bool changesSpeed = true;
+
+    // the center stays a radius away from the edge
+    static float inset(float radius)
+    {
+        return radius;
+    }
+
+    static void apply(float position, float &speed, float lower, float upper)
+    {
+        speed *= (position > upper) | (position < lower) ? -1.0f : 1.0f;
+    }
+
+#ifdef __AVX2__
+    static void apply(__m256 position, __m256 &speed, __m256 lower, __m256 upper)
+    {
+        __m256 outside = _mm256_or_ps(_mm256_cmp_ps(position, upper, _CMP_GT_OQ), _mm256_cmp_ps(position, lower, _CMP_LT_OQ));
+        speed = _mm256_xor_ps(speed, _mm256_and_ps(outside, _mm256_set1_ps(-0.0f)));
+    }
+#endif
+};
+
+// the circle leaves the screen and comes back in at the opposite edge
+struct WrapBoundary
+{
+    static const bool movesPosition = true;
+    static const bool changesSpeed = false;
+
+    static float inset(float)
+    {
+        return 0.0f;
+    }
+
+    static void apply(float &position, float, float lower, float upper)
+    {
+        position += (position > upper ? lower - upper : 0.0f) + (position < lower ? upper - lower : 0.0f);
+    }
+
+#ifdef __AVX2__
+    static void apply(__m256 &position, __m256, __m256 lower, __m256 upper)
+    {
+        __m256 span = _mm256_sub_ps(upper, lower);
+        __m256 above = _mm256_and_ps(_mm256_cmp_ps(position, upper, _CMP_GT_OQ), span);
+        __m256 below = _mm256_and_ps(_mm256_cmp_ps(position, lower, _CMP_LT_OQ), span);
+        position = _mm256_add_ps(_mm256_sub_ps(position, above), below);
+    }
+#endif
+};
+
+// Move every circle by its speed (Integrate), then apply the boundary to the
+// circles that reached a screen edge (Bounded). Both are normally fused into
+// one pass over the arrays; the separate passes exist so they can be timed on
+// their own.
+template <bool Integrate, bool Bounded, typename Boundary = ReflectBoundary>
+inline void particleKernel(ParticleStore &particles, float radius)
+{
+    const float lower = -1.0f + Boundary::inset(radius);
+    const float upper = 1.0f - Boundary::inset(radius);
+    const bool storePositions = Integrate || (Bounded && Boundary::movesPosition);
+    const bool storeSpeeds = Bounded && Boundary::changesSpeed;
+
+#ifdef __AVX2__
+    const int vectorCount = particles.count / particleLanes * particleLanes;
+    const __m256 lowerBound = _mm256_set1_ps(lower);
+    const __m256 upperBound = _mm256_set1_ps(upper);
+
+#pragma omp parallel for schedule(static)
+    for (int circle = 0; circle < vectorCount; circle += particleLanes)
+    {
+        __m256 x = _mm256_load_ps(particles.x + circle);
+        __m256 y = _mm256_load_ps(particles.y + circle);
+        __m256 vx = _mm256_load_ps(particles.vx + circle);
+        __m256 vy = _mm256_load_ps(particles.vy + circle);
+
+        if (Integrate)
+        {
+            x = _mm256_add_ps(x, vx);
+            y = _mm256_add_ps(y, vy);
+        }
+        if (Bounded)
+        {
+            Boundary::apply(x, vx, lowerBound, upperBound);
+            Boundary::apply(y, vy, lowerBound, upperBound);
+        }
+        if (storePositions)
+        {
+            _mm256_store_ps(particles.x + circle, x);
+            _mm256_store_ps(particles.y + circle, y);
+        }
+        if (storeSpeeds)
+        {
+            _mm256_store_ps(particles.vx + circle, vx);
+            _mm256_store_ps(particles.vy + circle, vy);
+        }
+    }
+    const int scalarStart = vectorCount;
+#else
+    const int scalarStart = 0;
+#endif
+
+    // remaining circles (all of them without AVX2), compiled to selects rather than branches
+#pragma omp parallel for schedule(static)
+    for (int circle = scalarStart; circle < particles.count; circle++)
+    {
+        float x = particles.x[circle];
+        float y = particles.y[circle];
+        float vx = particles.vx[circle];
+        float vy = particles.vy[circle];
+        if (Integrate)
+        {
+            x += vx;
+            y += vy;
+        }
+        if (Bounded)
+        {
+            Boundary::apply(x, vx, lower, upper);
+            Boundary::apply(y, vy, lower, upper);
+        }
+        if (storePositions)
+        {
+            particles.x[circle] = x;
+            particles.y[circle] = y;
+        }
+        if (storeSpeeds)
+        {
+            particles.vx[circle] = vx;
+            particles.vy[circle] = vy;
+        }
+    }
+}
+
+template <typename Boundary>
+inline void integrateAndBound(ParticleStore &particles, float radius)
+{
+    particleKernel<true, true, Boundary>(particles, radius);
+}
+
+inline void integrateAndReflect(ParticleStore &particles, float radius)
+{
+    particleKernel<true, true, ReflectBoundary>(particles, radius);
+}
+
+inline void integrateParticles(ParticleStore &particles)
+{
+    particleKernel<true, false>(particles, 0.0f);
+}
+
+inline void reflectParticles(ParticleStore &particles, float radius)
+{
+    particleKernel<false, true, ReflectBoundary>(particles, radius);
+}
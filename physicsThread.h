@@ -0,0 +1,183 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "particleStore.h"
+#include "simulation.h"
+
+// Physics on its own thread
+// -------------------------
+// The physics thread steps the simulation at a fixed timestep, paced against
+// the wall clock, and after every step publishes the circle positions through
+// a lock-free triple buffer. The render thread picks up the newest snapshot
+// whenever it starts a frame and draws the circles interpolated between the
+// two most recent snapshots, so neither thread ever waits for the other.
+
+// Single producer, single consumer triple buffer. The writer always owns one
+// slot and the reader another; the third is exchanged atomically on publish
+// and acquire, so the reader always gets the most recently published value.
+template <typename T>
+struct TripleBuffer
+{
+    static const int freshBit = 4; // set in middle while it holds an unread value
+
+    T slots[3];
+    int writeIndex = 0; // writer side only
+    int readIndex = 1;  // reader side only
+    std::atomic<int> middle{2};
+
+    T &writeSlot()
+    {
+        return slots[writeIndex];
+    }
+
+    // hand the write slot over to the reader and take the middle one
+    void publish()
+    {
+        writeIndex = middle.exchange(writeIndex | freshBit, std::memory_order_acq_rel) & ~freshBit;
+    }
+
+    // take the newest value if one was published since the last call
+    bool acquire()
+    {
+        if ((middle.load(std::memory_order_relaxed) & freshBit) == 0)
+        {
+            return false;
+        }
+        readIndex = middle.exchange(readIndex, std::memory_order_acq_rel) & ~freshBit;
+        return true;
+    }
+
+    const T &readSlot() const
+    {
+        return slots[readIndex];
+    }
+};
+
+struct PhysicsSnapshot
+{
+    std::vector<float> x;
+    std::vector<float> y;
+    long long step = 0;
+    double time = 0.0; // wall clock time the step was due, in seconds
+};
+
+inline double physicsClock()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct PhysicsThread
+{
+    Simulation *simulation = NULL;
+    double timestep = 1.0 / 60.0;
+
+    std::thread thread;
+    std::atomic<bool> running{false};
+    TripleBuffer<PhysicsSnapshot> snapshots;
+
+    // render thread side: the two newest snapshots
+    PhysicsSnapshot previous;
+    PhysicsSnapshot current;
+};
+
+// snapshots are indexed by stable circle id, so interpolating between two of
+// them stays correct when the storage was reordered in between
+inline void copySnapshot(PhysicsSnapshot &snapshot, const Simulation &simulation, double time)
+{
+    const ParticleStore &particles = simulation.particles;
+    const int *ids = simulation.spatialOrder.ids.data();
+    for (int slot = 0; slot < particles.count; slot++)
+    {
+        snapshot.x[ids[slot]] = particles.x[slot];
+        snapshot.y[ids[slot]] = particles.y[slot];
+    }
+    snapshot.step = simulation.step;
+    snapshot.time = time;
+}
+
+inline void runPhysicsThread(PhysicsThread &physics)
+{
+    Simulation &simulation = *physics.simulation;
+    double nextStep = physicsClock();
+
+    while (physics.running.load(std::memory_order_relaxed))
+    {
+        stepSimulation(simulation);
+        nextStep += physics.timestep;
+
+        PhysicsSnapshot &snapshot = physics.snapshots.writeSlot();
+        copySnapshot(snapshot, simulation, nextStep);
+        physics.snapshots.publish();
+
+        // when a step took longer than a few timesteps, drop the backlog instead of racing to catch up
+        double now = physicsClock();
+        if (now > nextStep + 4.0 * physics.timestep)
+        {
+            nextStep = now;
+        }
+        std::this_thread::sleep_for(std::chrono::duration<double>(nextStep - now));
+    }
+}
+
+inline void startPhysicsThread(PhysicsThread &physics, Simulation &simulation, double timestep)
+{
+    physics.simulation = &simulation;
+    physics.timestep = timestep;
+
+    int numCircles = simulation.particles.count;
+    for (PhysicsSnapshot &snapshot : physics.snapshots.slots)
+    {
+        snapshot.x.assign(numCircles, 0.0f);
+        snapshot.y.assign(numCircles, 0.0f);
+    }
+
+    // the current state is the first snapshot, so there is something to draw right away
+    physics.previous = physics.snapshots.slots[0];
+    copySnapshot(physics.previous, simulation, physicsClock());
+    physics.current = physics.previous;
+
+    physics.running = true;
+    physics.thread = std::thread(runPhysicsThread, std::ref(physics));
+}
+
+inline void stopPhysicsThread(PhysicsThread &physics)
+{
+    physics.running = false;
+    if (physics.thread.joinable())
+    {
+        physics.thread.join();
+    }
+}
+
+// write the circle positions at wall clock time now into particles, blending
+// the two newest snapshots; drawing one timestep behind keeps now between them
+inline void interpolatePhysics(PhysicsThread &physics, ParticleStore &particles, double now)
+{
+    if (physics.snapshots.acquire())
+    {
+        // swapping keeps both vectors allocated, the copy then reuses their storage
+        std::swap(physics.previous, physics.current);
+        physics.current = physics.snapshots.readSlot();
+    }
+
+    double span = physics.current.time - physics.previous.time;
+    double renderTime = now - physics.timestep;
+    float alpha = span > 0.0 ? (float)std::min(std::max((renderTime - physics.previous.time) / span, 0.0), 1.0) : 1.0f;
+
+    const float *previousX = physics.previous.x.data();
+    const float *previousY = physics.previous.y.data();
+    const float *currentX = physics.current.x.data();
+    const float *currentY = physics.current.y.data();
+
+#pragma omp parallel for schedule(static)
+    for (int circle = 0; circle < particles.count; circle++)
+    {
+        particles.x[circle] = previousX[circle] + alpha * (currentX[circle] - previousX[circle]);
+        particles.y[circle] = previousY[circle] + alpha * (currentY[circle] - previousY[circle]);
+    }
+}
@@ -0,0 +1,290 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "particleStore.h"
+
+// Scene files
+// -----------
+// Scenes made by other tools are read from one of two formats:
+//
+// Binary: a 24-byte header followed by one record of 4 floats (x, y, vx, vy)
+// per circle, in the machine's byte order:
+//
+//   "BUBSCENE" | uint32 version (1) | int32 count | float radius (0 if none) | uint32 reserved
+//
+// CSV: one circle per line as x,y,vx,vy with an optional fifth column with its
+// radius. A first line that does not start with a number is taken as the
+// column names. Every circle in a simulation has the same radius, so the
+// largest one given is used.
+//
+// The file is mapped rather than read, and the circles go straight from the
+// mapping into the particle arrays. A CSV file is cut into fixed chunks that
+// are parsed in parallel: one pass counts the lines of every chunk so each
+// knows where its circles go, a second pass parses them into place.
+
+const char sceneMagic[8] = {'B', 'U', 'B', 'S', 'C', 'E', 'N', 'E'};
+const uint32_t sceneVersion = 1;
+const size_t sceneChunkBytes = 1 << 22; // bytes of CSV per parsing task
+
+struct SceneHeader
+{
+    char magic[8];
+    uint32_t version;
+    int32_t count;
+    float radius;
+    uint32_t reserved;
+};
+
+struct MappedFile
+{
+    const char *data = NULL;
+    size_t bytes = 0;
+
+    MappedFile() = default;
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    ~MappedFile()
+    {
+        if (data != NULL)
+        {
+            munmap((void *)data, bytes);
+        }
+    }
+};
+
+// map the whole file at path for reading, front to back
+inline bool mapFile(MappedFile &file, const std::string &path)
+{
+    int descriptor = open(path.c_str(), O_RDONLY);
+    if (descriptor < 0)
+    {
+        std::cout << "Failed to open " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    struct stat status;
+    if (fstat(descriptor, &status) != 0 || status.st_size == 0)
+    {
+        std::cout << path << " is empty" << std::endl;
+        close(descriptor);
+        return false;
+    }
+
+    void *data = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    close(descriptor);
+    if (data == MAP_FAILED)
+    {
+        std::cout << "Failed to map " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    // every byte is read once, front to back
+    madvise(data, status.st_size, MADV_SEQUENTIAL);
+    file.data = (const char *)data;
+    file.bytes = status.st_size;
+    return true;
+}
+
+inline bool isBinaryScene(const MappedFile &file)
+{
+    return file.bytes >= sizeof(SceneHeader) && memcmp(file.data, sceneMagic, sizeof(sceneMagic)) == 0;
+}
+
+// radius is left alone when the file does not give one
+inline bool loadBinaryScene(const MappedFile &file, const std::string &path, ParticleStore &particles, float &radius)
+{
+    SceneHeader header;
+    memcpy(&header, file.data, sizeof(header));
+    if (header.version != sceneVersion || header.count <= 0 ||
+        file.bytes != sizeof(SceneHeader) + 4 * sizeof(float) * (size_t)header.count)
+    {
+        std::cout << "Scene " << path << " is not a version " << sceneVersion << " scene" << std::endl;
+        return false;
+    }
+
+    allocateParticles(particles, header.count);
+    const char *records = file.data + sizeof(SceneHeader);
+
+#pragma omp parallel for schedule(static)
+    for (int circle = 0; circle < header.count; circle++)
+    {
+        float record[4];
+        memcpy(record, records + sizeof(record) * (size_t)circle, sizeof(record));
+        particles.x[circle] = record[0];
+        particles.y[circle] = record[1];
+        particles.vx[circle] = record[2];
+        particles.vy[circle] = record[3];
+    }
+
+    if (header.radius > 0.0f)
+    {
+        radius = header.radius;
+    }
+    return true;
+}
+
+// the first line break at or after offset, plus one; the end of the file if there is none
+inline size_t nextLineStart(const MappedFile &file, size_t offset)
+{
+    const void *lineBreak = offset < file.bytes ? memchr(file.data + offset, '\n', file.bytes - offset) : NULL;
+    return lineBreak != NULL ? (const char *)lineBreak - file.data + 1 : file.bytes;
+}
+
+inline bool isBlankLine(const char *begin, const char *end)
+{
+    return std::all_of(begin, end, [](char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; });
+}
+
+// parse the next comma-separated number of a line, moving text past it
+inline bool parseSceneNumber(const char *&text, const char *end, float &number, bool first)
+{
+    while (text < end && (*text == ' ' || *text == '\t'))
+    {
+        text++;
+    }
+    if (!first)
+    {
+        if (text == end || *text != ',')
+        {
+            return false;
+        }
+        text++;
+        while (text < end && (*text == ' ' || *text == '\t'))
+        {
+            text++;
+        }
+    }
+    std::from_chars_result result = std::from_chars(text, end, number);
+    if (result.ec != std::errc())
+    {
+        return false;
+    }
+    text = result.ptr;
+    return true;
+}
+
+inline bool loadCsvScene(const MappedFile &file, const std::string &path, ParticleStore &particles, float &radius)
+{
+    // skip the column names, if any
+    size_t begin = 0;
+    char first = file.data[0];
+    if (!(isdigit(first) || first == '-' || first == '+' || first == '.'))
+    {
+        begin = nextLineStart(file, 0);
+    }
+
+    // chunks start at the first line that begins inside them
+    int numChunks = (int)((file.bytes - begin + sceneChunkBytes - 1) / sceneChunkBytes);
+    std::vector<size_t> chunkStart(numChunks + 1);
+    for (int chunk = 0; chunk < numChunks; chunk++)
+    {
+        size_t offset = begin + chunk * sceneChunkBytes;
+        chunkStart[chunk] = chunk == 0 ? begin : nextLineStart(file, offset - 1);
+    }
+    chunkStart[numChunks] = file.bytes;
+
+    // first pass: circles (non-blank lines) in each chunk
+    std::vector<long long> chunkCircles(numChunks + 1, 0);
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int chunk = 0; chunk < numChunks; chunk++)
+    {
+        long long circles = 0;
+        for (size_t line = chunkStart[chunk]; line < chunkStart[chunk + 1];)
+        {
+            size_t next = nextLineStart(file, line);
+            if (!isBlankLine(file.data + line, file.data + std::min(next, chunkStart[chunk + 1])))
+            {
+                circles++;
+            }
+            line = next;
+        }
+        chunkCircles[chunk + 1] = circles;
+    }
+    for (int chunk = 0; chunk < numChunks; chunk++)
+    {
+        chunkCircles[chunk + 1] += chunkCircles[chunk];
+    }
+    long long numCircles = chunkCircles[numChunks];
+    if (numCircles == 0 || numCircles > 0x7fffffff)
+    {
+        std::cout << "Scene " << path << " has " << numCircles << " circles" << std::endl;
+        return false;
+    }
+
+    // second pass: parse every chunk into its place
+    allocateParticles(particles, (int)numCircles);
+    long long badCircle = -1; // the first circle that failed to parse
+    float largestRadius = 0.0f;
+#pragma omp parallel for schedule(dynamic, 1) reduction(max : largestRadius)
+    for (int chunk = 0; chunk < numChunks; chunk++)
+    {
+        long long circle = chunkCircles[chunk];
+        for (size_t line = chunkStart[chunk]; line < chunkStart[chunk + 1];)
+        {
+            size_t next = nextLineStart(file, line);
+            const char *text = file.data + line;
+            const char *end = file.data + std::min(next, chunkStart[chunk + 1]);
+            line = next;
+            if (isBlankLine(text, end))
+            {
+                continue;
+            }
+
+            float values[5];
+            bool valid = parseSceneNumber(text, end, values[0], true) && parseSceneNumber(text, end, values[1], false) &&
+                         parseSceneNumber(text, end, values[2], false) && parseSceneNumber(text, end, values[3], false);
+            if (valid && parseSceneNumber(text, end, values[4], false))
+            {
+                largestRadius = std::max(largestRadius, values[4]);
+            }
+            if (!valid || !isBlankLine(text, end))
+            {
+#pragma omp critical(sceneError)
+                badCircle = badCircle < 0 ? circle : std::min(badCircle, circle);
+                break;
+            }
+
+            particles.x[circle] = values[0];
+            particles.y[circle] = values[1];
+            particles.vx[circle] = values[2];
+            particles.vy[circle] = values[3];
+            circle++;
+        }
+    }
+
+    if (badCircle >= 0)
+    {
+        std::cout << "Scene " << path << ": circle " << badCircle + 1 << " is not x,y,vx,vy[,radius]" << std::endl;
+        return false;
+    }
+    if (largestRadius > 0.0f)
+    {
+        radius = largestRadius;
+    }
+    return true;
+}
+
+// fill particles from the binary or CSV scene at path; radius is replaced when the scene gives one
+inline bool loadSceneFile(const std::string &path, ParticleStore &particles, float &radius)
+{
+    MappedFile file;
+    if (!mapFile(file, path))
+    {
+        return false;
+    }
+    return isBinaryScene(file) ? loadBinaryScene(file, path, particles, radius)
+                               : loadCsvScene(file, path, particles, radius);
+}
@@ -0,0 +1,491 @@
+#pragma once
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "options.h"
+#include "particleStore.h"
+#include "collisions.h"
+#include "contactSolver.h"
+#include "eventEngine.h"
+#include "attraction.h"
+#include "frameTimer.h"
+#include "counterRandom.h"
+#include "checkpoint.h"
+#include "sceneLoader.h"
+#include "trajectoryRecorder.h"
+#include "trajectoryReplay.h"
+#include "spatialOrder.h"
+
+// The circle physics, independent of any window or GL context
+// ------------------------------------------------------------
+struct Simulation
+{
+    ParticleStore particles;
+    float radius = 0.10f;
+    float restitution = 1.0f;
+    EngineMode engine = EngineMode::Step;
+    EventEngine events;
+    BroadphaseMode broadphase = BroadphaseMode::Grid;
+
+    UniformGrid grid;
+    SweepAndPrune sweep;
+    VerletList verlet;
+    TiledContacts tiles;
+
+    int reorderInterval = 0;   // steps between Morton reorders of the storage, 0 for never
+    SpatialOrder spatialOrder; // stable id of every storage slot
+    ContactList contacts;
+
+    SolverMode solver = SolverMode::Sequential;
+    int solverIterations = 4;
+    ContactColoring coloring;
+
+    float attraction = 0.0f; // strength of the pull between circles
+    float theta = 0.5f;
+    QuadTree tree;
+    long long step = 0; // steps taken since the scene was created
+
+    FrameTimer *timer = NULL; // times the integrate and collision phases when set
+
+    unsigned long long seed = 1; // seed the scene was created from
+    std::string checkpointPath;  // checkpoints are written here
+    int checkpointInterval = 0;  // steps between checkpoints, 0 for only at exit
+
+    TrajectoryRecorder *recorder = NULL; // records the positions every recorder->interval steps when set
+
+    BoundaryMode boundary = BoundaryMode::Reflect;
+    PrecisionMode precision = PrecisionMode::Float;
+    void (*stepKernel)(Simulation &) = NULL;   // the step engine specialized for the options above
+    void (*findContacts)(Simulation &) = NULL; // the broadphase, chosen with the step kernel
+};
+
+inline void selectStepKernel(Simulation &simulation); // below the step engine
+
+// set every parameter of the simulation, but not the circles
+inline void initSimulation(Simulation &simulation, const Options &options, float radius, float restitution)
+{
+    simulation.radius = radius;
+    simulation.restitution = restitution;
+    simulation.engine = options.engine;
+    resetEventEngine(simulation.events);
+    simulation.broadphase = options.broadphase;
+    simulation.step = 0;
+    initGrid(simulation.grid, radius);
+    initVerletList(simulation.verlet, float(options.skin) * radius);
+    simulation.reorderInterval = options.reorderInterval;
+    simulation.solver = options.solver;
+    simulation.solverIterations = options.solverIterations;
+    simulation.attraction = float(options.attraction);
+    simulation.theta = float(options.theta);
+    resetSweepAndPrune(simulation.sweep);
+    simulation.seed = options.seed;
+    simulation.checkpointPath = options.checkpointPath;
+    simulation.checkpointInterval = options.checkpointInterval;
+    simulation.boundary = options.boundary;
+    simulation.precision = options.precision;
+    selectStepKernel(simulation);
+}
+
+// place numCircles circles at random and give them all the same initial speed;
+// each circle's position only depends on the seed and its index
+inline void createScene(Simulation &simulation, const Options &options, float radius, float restitution)
+{
+    int numCircles = options.numCircles;
+    initSimulation(simulation, options, radius, restitution);
+
+    ParticleStore &particles = simulation.particles;
+    allocateParticles(particles, numCircles);
+
+    uint64_t seed = options.seed;
+#pragma omp parallel for schedule(static)
+    for (int circle = 0; circle < numCircles; circle++)
+    {
+        float centerX = 2.0f * counterRandomFloat(seed, circle, StreamPositionX) - 1.0f;
+        float centerY = 2.0f * counterRandomFloat(seed, circle, StreamPositionY) - 1.0f;
+
+        particles.x[circle] = centerX;
+        particles.y[circle] = centerY;
+
+        // Initialize speeds for each circle (you can set different initial speeds)
+        float initialSpeedX = 0.0005f;
+        float initialSpeedY = 0.0005f;
+        particles.vx[circle] = initialSpeedX;
+        particles.vy[circle] = initialSpeedY;
+    }
+    initSpatialOrder(simulation.spatialOrder, numCircles);
+}
+
+// start from the circles of the scene file at path; its radius replaces the given one when it has one
+inline bool loadScene(Simulation &simulation, const Options &options, const std::string &path, float radius,
+                      float restitution)
+{
+    if (!loadSceneFile(path, simulation.particles, radius))
+    {
+        return false;
+    }
+    initSimulation(simulation, options, radius, restitution);
+    initSpatialOrder(simulation.spatialOrder, simulation.particles.count);
+    return true;
+}
+
+// show the recorded trajectory at path instead of simulating, starting at options.replayStart
+inline bool loadReplay(Simulation &simulation, TrajectoryReplay &replay, const Options &options, const std::string &path,
+                       float restitution)
+{
+    if (!openTrajectory(replay, path))
+    {
+        return false;
+    }
+    if (options.replayStart >= replay.frames)
+    {
+        std::cout << "Trajectory " << path << " has only " << replay.frames << " frames" << std::endl;
+        return false;
+    }
+    initSimulation(simulation, options, replay.header.radius, restitution);
+    allocateParticles(simulation.particles, replay.header.count);
+    initSpatialOrder(simulation.spatialOrder, replay.header.count);
+    return showTrajectoryFrame(replay, simulation.particles, options.replayStart);
+}
+
+inline bool saveCheckpoint(const Simulation &simulation, const std::string &path)
+{
+    CheckpointHeader header = {};
+    header.step = simulation.step;
+    header.radius = simulation.radius;
+    header.restitution = simulation.restitution;
+    header.seed = simulation.seed;
+    return writeCheckpointFile(path, header, simulation.particles, simulation.spatialOrder.ids.data());
+}
+
+// continue from the checkpoint at path; its radius, restitution, seed and step
+// replace the ones of the command line, the other options still apply
+inline bool restoreCheckpoint(Simulation &simulation, const Options &options, const std::string &path)
+{
+    CheckpointHeader header;
+    std::vector<int> ids;
+    if (!readCheckpointFile(path, header, simulation.particles, ids))
+    {
+        return false;
+    }
+    if (options.engine == EngineMode::Event && header.restitution < 1.0f)
+    {
+        // see parseOptions
+        std::cout << "Checkpoint " << path << " has inelastic collisions, which the event engine cannot run"
+                  << std::endl;
+        return false;
+    }
+    Options restored = options;
+    restored.seed = header.seed;
+    initSimulation(simulation, restored, header.radius, header.restitution);
+    simulation.step = header.step;
+
+    // the ids must be a permutation of the slots
+    SpatialOrder &spatial = simulation.spatialOrder;
+    spatial.ids.swap(ids);
+    spatial.slots.assign(header.count, -1);
+    for (int slot = 0; slot < header.count; slot++)
+    {
+        int id = spatial.ids[slot];
+        if (id < 0 || id >= header.count || spatial.slots[id] >= 0)
+        {
+            std::cout << "Checkpoint " << path << " has invalid circle ids" << std::endl;
+            return false;
+        }
+        spatial.slots[id] = slot;
+    }
+    spatial.reorders = 0;
+    return true;
+}
+
+inline void saveCheckpointIfDue(const Simulation &simulation)
+{
+    if (simulation.checkpointInterval > 0 && simulation.step % simulation.checkpointInterval == 0)
+    {
+        saveCheckpoint(simulation, simulation.checkpointPath);
+    }
+}
+
+inline void recordTrajectoryIfDue(Simulation &simulation)
+{
+    TrajectoryRecorder *recorder = simulation.recorder;
+    if (recorder != NULL && simulation.step % recorder->interval == 0)
+    {
+        recordTrajectoryFrame(*recorder, simulation.particles, simulation.spatialOrder.ids.data(), simulation.step);
+    }
+}
+
+// start recording to path, beginning with the current positions
+inline bool startRecording(Simulation &simulation, TrajectoryRecorder &recorder, const std::string &path, int interval)
+{
+    if (!startTrajectoryRecorder(recorder, path, interval, simulation.particles.count, simulation.radius))
+    {
+        return false;
+    }
+    simulation.recorder = &recorder;
+    recordTrajectoryFrame(recorder, simulation.particles, simulation.spatialOrder.ids.data(), simulation.step);
+    return true;
+}
+
+// the bookkeeping at the end of every step
+inline void finishStep(Simulation &simulation)
+{
+    simulation.step++;
+    saveCheckpointIfDue(simulation);
+    recordTrajectoryIfDue(simulation);
+}
+
+// the broadphases, behind one signature so the step can call the chosen one
+// through Simulation::findContacts
+inline void findSimulationContactsGrid(Simulation &simulation)
+{
+    findContactsGrid(simulation.contacts, simulation.grid, simulation.particles, simulation.radius);
+}
+
+inline void findSimulationContactsSweepAndPrune(Simulation &simulation)
+{
+    findContactsSweepAndPrune(simulation.contacts, simulation.sweep, simulation.particles, simulation.radius);
+}
+
+inline void findSimulationContactsVerlet(Simulation &simulation)
+{
+    findContactsVerlet(simulation.contacts, simulation.verlet, simulation.particles, simulation.radius);
+}
+
+inline void findSimulationContactsTiled(Simulation &simulation)
+{
+    findContactsTiled(simulation.contacts, simulation.tiles, simulation.particles, simulation.radius);
+}
+
+inline void findSimulationContactsBruteForce(Simulation &simulation)
+{
+    findContactsBruteForce(simulation.contacts, simulation.particles, simulation.radius);
+}
+
+// the contact solvers, a template parameter of the step
+struct SequentialSolver
+{
+    template <typename Scalar, typename Restitution>
+    static void solve(Simulation &simulation, Restitution restitution)
+    {
+        resolveContactsWith<Scalar>(simulation.contacts, simulation.particles, restitution);
+    }
+};
+
+struct ColoredSolver
+{
+    template <typename Scalar, typename Restitution>
+    static void solve(Simulation &simulation, Restitution restitution)
+    {
+        solveContactsColoredWith<Scalar>(simulation.coloring, simulation.contacts, simulation.particles, restitution,
+                                         simulation.solverIterations);
+    }
+};
+
+// One step of the step engine. The contact impulses are computed in Scalar,
+// Restitution says how much of the approach speed a contact takes away,
+// Boundary what the screen edges do and Solver how the contacts are resolved,
+// all fixed at compile time so that each combination is a kernel of its own
+// without tests in its loops. The broadphase is called through a function
+// pointer chosen at the same time. Only the attraction and the reorder
+// interval are still tested, once per step.
+template <typename Scalar, typename Restitution, typename Boundary, typename Solver>
+inline void stepSimulationWith(Simulation &simulation)
+{
+    ParticleStore &particles = simulation.particles;
+    PhaseTime phaseStart = phaseClock();
+    Restitution restitution(simulation.restitution);
+
+    // Pull the circles towards each other before they move and collide
+    if (simulation.attraction > 0.0f)
+    {
+        applyAttraction(simulation.tree, particles, simulation.attraction, simulation.theta, simulation.radius);
+        phaseStart = recordPhase(simulation.timer, PhaseAttraction, phaseStart);
+    }
+
+    // Update circle positions and bounce off (or wrap around) the screen edges
+    integrateAndBound<Boundary>(particles, simulation.radius);
+    phaseStart = recordPhase(simulation.timer, PhaseIntegrate, phaseStart);
+
+    // Check for collisions between circles
+    simulation.findContacts(simulation);
+    Solver::template solve<Scalar>(simulation, restitution);
+
+    // keep circles that are close on screen close in memory; the slots change,
+    // so the broadphases that remember slots start over
+    if (simulation.reorderInterval > 0 && (simulation.step + 1) % simulation.reorderInterval == 0)
+    {
+        reorderParticles(simulation.spatialOrder, particles);
+        resetSweepAndPrune(simulation.sweep);
+        resetVerletList(simulation.verlet);
+    }
+    recordPhase(simulation.timer, PhaseCollisions, phaseStart);
+
+    finishStep(simulation);
+}
+
+template <typename Scalar, typename Restitution, typename Boundary>
+inline void selectSolverKernel(Simulation &simulation)
+{
+    if (simulation.solver == SolverMode::Colored)
+    {
+        simulation.stepKernel = stepSimulationWith<Scalar, Restitution, Boundary, ColoredSolver>;
+    }
+    else
+    {
+        simulation.stepKernel = stepSimulationWith<Scalar, Restitution, Boundary, SequentialSolver>;
+    }
+}
+
+template <typename Scalar, typename Restitution>
+inline void selectBoundaryKernel(Simulation &simulation)
+{
+    if (simulation.boundary == BoundaryMode::Wrap)
+    {
+        selectSolverKernel<Scalar, Restitution, WrapBoundary>(simulation);
+    }
+    else
+    {
+        selectSolverKernel<Scalar, Restitution, ReflectBoundary>(simulation);
+    }
+}
+
+template <typename Scalar>
+inline void selectRestitutionKernel(Simulation &simulation)
+{
+    if (simulation.restitution == 1.0f)
+    {
+        selectBoundaryKernel<Scalar, ElasticRestitution>(simulation);
+    }
+    else
+    {
+        selectBoundaryKernel<Scalar, GivenRestitution>(simulation);
+    }
+}
+
+inline void selectBroadphase(Simulation &simulation)
+{
+    if (simulation.broadphase == BroadphaseMode::Grid)
+    {
+        simulation.findContacts = findSimulationContactsGrid;
+    }
+    else if (simulation.broadphase == BroadphaseMode::SweepAndPrune)
+    {
+        simulation.findContacts = findSimulationContactsSweepAndPrune;
+    }
+    else if (simulation.broadphase == BroadphaseMode::Verlet)
+    {
+        simulation.findContacts = findSimulationContactsVerlet;
+    }
+    else if (simulation.broadphase == BroadphaseMode::Tiled)
+    {
+        simulation.findContacts = findSimulationContactsTiled;
+    }
+    else
+    {
+        simulation.findContacts = findSimulationContactsBruteForce;
+    }
+}
+
+// pick the step kernel and the broadphase once, when the simulation is set up,
+// instead of testing the options again in every step
+inline void selectStepKernel(Simulation &simulation)
+{
+    selectBroadphase(simulation);
+    if (simulation.precision == PrecisionMode::Double)
+    {
+        selectRestitutionKernel<double>(simulation);
+    }
+    else
+    {
+        selectRestitutionKernel<float>(simulation);
+    }
+}
+
+inline void stepSimulation(Simulation &simulation)
+{
+    if (simulation.engine == EngineMode::Event)
+    {
+        // motion and collisions are one pass over the events of the step
+        PhaseTime phaseStart = phaseClock();
+        advanceEvents(simulation.events, simulation.particles, simulation.radius, simulation.restitution, 1.0);
+        recordPhase(simulation.timer, PhaseCollisions, phaseStart);
+        finishStep(simulation);
+        return;
+    }
+    simulation.stepKernel(simulation);
+}
+
+// hash of every circle's position and speed bits, in stable id order; two runs
+// agree bit for bit exactly when their checksums match
+inline uint64_t stateChecksum(const Simulation &simulation)
+{
+    const ParticleStore &particles = simulation.particles;
+    const std::vector<int> &slots = simulation.spatialOrder.slots;
+    uint64_t checksum = 0;
+    for (int id = 0; id < particles.count; id++)
+    {
+        int slot = slots[id];
+        const float values[4] = {particles.x[slot], particles.y[slot], particles.vx[slot], particles.vy[slot]};
+        for (float value : values)
+        {
+            uint32_t bits;
+            memcpy(&bits, &value, sizeof(bits));
+            checksum = splitMix64(checksum ^ bits);
+        }
+    }
+    return checksum;
+}
+
+// the per-step scratch: the contact lists and the attraction's quadtree
+inline FrameArenaStats scratchStats(const Simulation &simulation)
+{
+    FrameArenaStats stats = frameArenaStats(simulation.contacts.arenas);
+    addArenaStats(stats, simulation.tree.arena);
+    return stats;
+}
+
+// run a fixed number of steps without a window and report the throughput
+inline void runHeadless(Simulation &simulation, int steps)
+{
+    // the first half of the steps is the warm-up of the scratch arenas, which
+    // must not allocate from the heap after it
+    int warmupSteps = steps / 2;
+    long long warmupHeapBlocks = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int step = 0; step < steps; step++)
+    {
+        if (step == warmupSteps)
+        {
+            warmupHeapBlocks = scratchStats(simulation).heapBlocks;
+        }
+        stepSimulation(simulation);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    double nsPerCircleStep = elapsed.count() * 1e9 / (double(steps) * simulation.particles.count);
+    std::cout << "Circles: " << simulation.particles.count << "\n"
+              << "Steps: " << steps << "\n"
+              << "Total time: " << elapsed.count() << " s\n"
+              << "ns/circle/step: " << nsPerCircleStep << "\n"
+              << "Checksum: " << std::hex << stateChecksum(simulation) << std::dec << std::endl;
+    if (simulation.engine == EngineMode::Event)
+    {
+        std::cout << "Collisions: " << simulation.events.collisions << std::endl;
+    }
+    else
+    {
+        FrameArenaStats scratch = scratchStats(simulation);
+        long long lateHeapBlocks = scratch.heapBlocks - warmupHeapBlocks;
+        std::cout << "Scratch high water: " << scratch.highWater / (1024.0 * 1024.0) << " MB ("
+                  << scratch.heapBlocks << " heap blocks, " << lateHeapBlocks << " after warm-up)" << std::endl;
+        if (lateHeapBlocks > 0)
+        {
+            std::cout << "Warning: the scratch arenas still allocated in the last " << steps - warmupSteps
+                      << " steps" << std::endl;
+        }
+    }
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "particleStore.h"
+
+// Morton order of the circle storage
+// ----------------------------------
+// The circles start out in creation order, so neighbours on screen are
+// scattered over the arrays and most neighbour lookups miss the cache. Every
+// few steps the arrays are sorted by the Morton (Z-curve) code of each
+// circle's position on a 65536 x 65536 grid over the screen, which keeps
+// circles that are close on screen close in memory. The code is far finer than
+// the collision grid, so the circles inside one collision cell are ordered
+// along the curve too instead of keeping their old order. Slots change on
+// every reorder, so each slot remembers the stable id of its circle; anything
+// that must follow one circle over time (snapshots, checksums, saved scenes)
+// goes through ids rather than slots.
+
+struct SpatialOrder
+{
+    std::vector<int> ids;   // stable id of the circle in each slot
+    std::vector<int> slots; // slot of each stable id
+
+    std::vector<uint32_t> codes; // scratch: Morton code of each slot
+    std::vector<int> order;      // scratch: old slot of each new slot
+    std::vector<int> reorderedIds;
+    ParticleStore reordered; // scratch store the circles are gathered into
+    long long reorders = 0;
+};
+
+// every circle keeps its creation index as id
+inline void initSpatialOrder(SpatialOrder &spatial, int numCircles)
+{
+    spatial.ids.resize(numCircles);
+    spatial.slots.resize(numCircles);
+    for (int circle = 0; circle < numCircles; circle++)
+    {
+        spatial.ids[circle] = circle;
+        spatial.slots[circle] = circle;
+    }
+    spatial.reorders = 0;
+}
+
+// spread the low 16 bits of value over the even bits
+inline uint32_t spreadBits(uint32_t value)
+{
+    value &= 0x0000ffff;
+    value = (value | (value << 8)) & 0x00ff00ff;
+    value = (value | (value << 4)) & 0x0f0f0f0f;
+    value = (value | (value << 2)) & 0x33333333;
+    value = (value | (value << 1)) & 0x55555555;
+    return value;
+}
+
+inline uint32_t mortonCode(int cellX, int cellY)
+{
+    return spreadBits((uint32_t)cellX) | (spreadBits((uint32_t)cellY) << 1);
+}
+
+const int mortonBits = 16; // bits per axis of positionCode
+
+// Morton code of a position on a 2^mortonBits grid over the screen
+inline uint32_t positionCode(float x, float y)
+{
+    const int cells = 1 << mortonBits;
+    int cellX = std::min(std::max(int((x + 1.0f) * 0.5f * cells), 0), cells - 1);
+    int cellY = std::min(std::max(int((y + 1.0f) * 0.5f * cells), 0), cells - 1);
+    return mortonCode(cellX, cellY);
+}
+
+// sort every per-circle array by the Morton code of the circle's position;
+// circles with the same code keep their relative order
+inline void reorderParticles(SpatialOrder &spatial, ParticleStore &particles)
+{
+    int numCircles = particles.count;
+    spatial.codes.resize(numCircles);
+    spatial.order.resize(numCircles);
+
+#pragma omp parallel for schedule(static)
+    for (int circle = 0; circle < numCircles; circle++)
+    {
+        spatial.codes[circle] = positionCode(particles.x[circle], particles.y[circle]);
+        spatial.order[circle] = circle;
+    }
+
+    const std::vector<uint32_t> &codes = spatial.codes;
+    std::sort(spatial.order.begin(), spatial.order.end(),
+              [&](int a, int b) { return codes[a] < codes[b] || (codes[a] == codes[b] && a < b); });
+
+    if (spatial.reordered.count != numCircles)
+    {
+        allocateParticles(spatial.reordered, numCircles);
+    }
+    ParticleStore &reordered = spatial.reordered;
+    spatial.reorderedIds.resize(numCircles);
+
+#pragma omp parallel for schedule(static)
+    for (int slot = 0; slot < numCircles; slot++)
+    {
+        int circle = spatial.order[slot];
+        reordered.x[slot] = particles.x[circle];
+        reordered.y[slot] = particles.y[circle];
+        reordered.vx[slot] = particles.vx[circle];
+        reordered.vy[slot] = particles.vy[circle];
+        spatial.reorderedIds[slot] = spatial.ids[circle];
+    }
+
+    // the old arrays become the scratch space of the next reorder
+    std::swap(particles, reordered);
+    std::swap(spatial.ids, spatial.reorderedIds);
+
+#pragma omp parallel for schedule(static)
+    for (int slot = 0; slot < numCircles; slot++)
+    {
+        spatial.slots[spatial.ids[slot]] = slot;
+    }
+    spatial.reorders++;
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <unistd.h>
+
+// Trajectory files
+// ----------------
+// A trajectory holds the circle positions of a run, one frame per recorded
+// step, in stable id order:
+//
+//   header | frame | frame | ... | keyframe index | trailer
+//
+// Positions are quantized to 1 / scale of a unit (1/65536, well below a pixel)
+// and every frame stores, for each circle, the change of its quantized x and y
+// since the frame before as zigzag varints. Circles move a few quanta per step,
+// so a frame takes about 2 bytes per circle instead of the 8 of two floats.
+// Every keyframeInterval-th frame is a keyframe, which stores the quantized
+// positions themselves, so a reader can start decoding at any keyframe.
+//
+// The index at the end lists the keyframes. It is only written when the
+// recording is closed; without it the frames can still be walked one by one.
+
+const char trajectoryMagic[8] = {'B', 'U', 'B', 'T', 'R', 'A', 'J', '\0'};
+const char trajectoryIndexMagic[8] = {'B', 'U', 'B', 'I', 'N', 'D', 'E', 'X'};
+const uint32_t trajectoryVersion = 1;
+const float trajectoryScale = 65536.0f;     // quanta per unit
+const int trajectoryKeyframeInterval = 60; // frames from one keyframe to the next
+
+struct TrajectoryHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t headerBytes;
+    int32_t count;
+    float scale;
+    float radius;
+    int32_t keyframeInterval;
+    char reserved[32];
+};
+static_assert(sizeof(TrajectoryHeader) == 64, "the header is 64 bytes on every platform");
+
+struct TrajectoryFrameHeader
+{
+    int64_t step;
+    uint32_t bytes;    // of the encoded positions after this header
+    uint32_t keyframe; // 1 when the positions are not deltas
+};
+
+struct TrajectoryKeyframe
+{
+    int64_t frame;
+    int64_t step;
+    uint64_t offset; // of the frame header in the file
+};
+
+struct TrajectoryTrailer
+{
+    uint64_t indexOffset;
+    int64_t frames;
+    int64_t keyframes;
+    char magic[8];
+};
+
+inline int32_t quantizePosition(float position)
+{
+    return (int32_t)lrintf(position * trajectoryScale);
+}
+
+// append value as a zigzag varint: small changes of either sign take one byte
+inline uint8_t *encodeVarint(uint8_t *out, int32_t value)
+{
+    uint32_t zigzag = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+    while (zigzag >= 0x80)
+    {
+        *out++ = uint8_t(zigzag | 0x80);
+        zigzag >>= 7;
+    }
+    *out++ = uint8_t(zigzag);
+    return out;
+}
+
+// read a zigzag varint, moving in past it; false when it runs past end
+inline bool decodeVarint(const uint8_t *&in, const uint8_t *end, int32_t &value)
+{
+    uint32_t zigzag = 0;
+    for (int shift = 0; shift < 35; shift += 7)
+    {
+        if (in == end)
+        {
+            return false;
+        }
+        uint8_t byte = *in++;
+        zigzag |= uint32_t(byte & 0x7f) << shift;
+        if (byte < 0x80)
+        {
+            value = int32_t(zigzag >> 1) ^ -int32_t(zigzag & 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+// encode the quantized positions of a frame against those of the previous
+// one (all zeros for a keyframe) and make them the previous ones
+inline size_t encodeTrajectoryFrame(std::vector<uint8_t> &encoded, const int32_t *x, const int32_t *y,
+                                    std::vector<int32_t> &previousX, std::vector<int32_t> &previousY, bool keyframe)
+{
+    int numCircles = (int)previousX.size();
+    encoded.resize(sizeof(TrajectoryFrameHeader) + 2 * 5 * (size_t)numCircles); // 5 bytes per varint at most
+    uint8_t *out = encoded.data() + sizeof(TrajectoryFrameHeader);
+    for (int circle = 0; circle < numCircles; circle++)
+    {
+        int32_t baseX = keyframe ? 0 : previousX[circle];
+        int32_t baseY = keyframe ? 0 : previousY[circle];
+        out = encodeVarint(out, x[circle] - baseX);
+        out = encodeVarint(out, y[circle] - baseY);
+        previousX[circle] = x[circle];
+        previousY[circle] = y[circle];
+    }
+    return out - encoded.data();
+}
+
+// write all of data, retrying short writes
+inline bool writeFully(int file, const void *data, size_t bytes)
+{
+    const char *remaining = (const char *)data;
+    while (bytes > 0)
+    {
+        ssize_t written = write(file, remaining, bytes);
+        if (written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (written <= 0)
+        {
+            return false;
+        }
+        remaining += written;
+        bytes -= written;
+    }
+    return true;
+}
@@ -0,0 +1,214 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "particleStore.h"
+#include "trajectory.h"
+
+// Asynchronous trajectory recorder
+// --------------------------------
+// The stepping thread only quantizes the positions of a recorded step into a
+// free slot of a lock-free single producer, single consumer ring. A writer
+// thread takes the slots in order, delta-encodes them (see trajectory.h) and
+// writes them out, so neither the encoding nor the disk is on the frame path.
+// When the writer falls behind and the ring is full, the step is dropped
+// rather than waiting; the next frame written is simply a delta against the
+// last frame that was written, so dropped steps never corrupt the file.
+
+const int trajectoryRingFrames = 8;
+
+struct TrajectorySlot
+{
+    std::vector<int32_t> x; // quantized positions by stable id
+    std::vector<int32_t> y;
+    long long step = 0;
+};
+
+struct TrajectoryRecorder
+{
+    int interval = 1; // steps between recorded frames
+
+    int file = -1;
+    std::string path;
+    TrajectorySlot slots[trajectoryRingFrames];
+    std::atomic<long long> head{0}; // frames handed over, written by the stepping thread only
+    std::atomic<long long> tail{0}; // frames taken, written by the writer thread only
+    std::atomic<bool> running{false};
+    std::thread thread;
+
+    // writer thread side
+    std::vector<int32_t> previousX;
+    std::vector<int32_t> previousY;
+    std::vector<uint8_t> encoded;
+    std::vector<TrajectoryKeyframe> keyframes;
+    uint64_t offset = 0;
+    long long frames = 0;
+    bool failed = false;
+
+    long long dropped = 0; // stepping thread side
+
+    // a recorder that was never stopped (e.g. on an early exit) still ends its thread
+    ~TrajectoryRecorder()
+    {
+        running = false;
+        if (thread.joinable())
+        {
+            thread.join();
+        }
+        if (file >= 0)
+        {
+            close(file);
+        }
+    }
+};
+
+// encode and write one frame, on the writer thread
+inline void writeTrajectoryFrame(TrajectoryRecorder &recorder, const TrajectorySlot &slot)
+{
+    bool keyframe = recorder.frames % trajectoryKeyframeInterval == 0;
+    size_t bytes = encodeTrajectoryFrame(recorder.encoded, slot.x.data(), slot.y.data(), recorder.previousX,
+                                         recorder.previousY, keyframe);
+
+    TrajectoryFrameHeader header = {slot.step, uint32_t(bytes - sizeof(TrajectoryFrameHeader)), keyframe ? 1u : 0u};
+    memcpy(recorder.encoded.data(), &header, sizeof(header));
+    if (keyframe)
+    {
+        recorder.keyframes.push_back({recorder.frames, slot.step, recorder.offset});
+    }
+    if (!recorder.failed && !writeFully(recorder.file, recorder.encoded.data(), bytes))
+    {
+        std::cout << "Failed to write trajectory " << recorder.path << ": " << strerror(errno) << std::endl;
+        recorder.failed = true;
+    }
+    recorder.offset += bytes;
+    recorder.frames++;
+}
+
+inline void runTrajectoryWriter(TrajectoryRecorder &recorder)
+{
+    for (;;)
+    {
+        long long tail = recorder.tail.load(std::memory_order_relaxed);
+        if (tail == recorder.head.load(std::memory_order_acquire))
+        {
+            // nothing queued: done once stopped, otherwise wait for the next step
+            if (!recorder.running.load(std::memory_order_acquire) &&
+                tail == recorder.head.load(std::memory_order_acquire))
+            {
+                return;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+        writeTrajectoryFrame(recorder, recorder.slots[tail % trajectoryRingFrames]);
+        recorder.tail.store(tail + 1, std::memory_order_release);
+    }
+}
+
+// record the positions in particles (slot order, with the stable id of each
+// slot in ids) unless the writer is a whole ring behind
+inline void recordTrajectoryFrame(TrajectoryRecorder &recorder, const ParticleStore &particles, const int *ids,
+                                  long long step)
+{
+    long long head = recorder.head.load(std::memory_order_relaxed);
+    if (head - recorder.tail.load(std::memory_order_acquire) == trajectoryRingFrames)
+    {
+        recorder.dropped++;
+        return;
+    }
+
+    TrajectorySlot &slot = recorder.slots[head % trajectoryRingFrames];
+    int32_t *x = slot.x.data();
+    int32_t *y = slot.y.data();
+#pragma omp parallel for schedule(static)
+    for (int circle = 0; circle < particles.count; circle++)
+    {
+        x[ids[circle]] = quantizePosition(particles.x[circle]);
+        y[ids[circle]] = quantizePosition(particles.y[circle]);
+    }
+    slot.step = step;
+    recorder.head.store(head + 1, std::memory_order_release);
+}
+
+inline bool startTrajectoryRecorder(TrajectoryRecorder &recorder, const std::string &path, int interval,
+                                    int numCircles, float radius)
+{
+    recorder.file = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (recorder.file < 0)
+    {
+        std::cout << "Failed to write trajectory " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    recorder.path = path;
+    recorder.interval = interval;
+
+    TrajectoryHeader header = {};
+    memcpy(header.magic, trajectoryMagic, sizeof(header.magic));
+    header.version = trajectoryVersion;
+    header.headerBytes = sizeof(TrajectoryHeader);
+    header.count = numCircles;
+    header.scale = trajectoryScale;
+    header.radius = radius;
+    header.keyframeInterval = trajectoryKeyframeInterval;
+    if (!writeFully(recorder.file, &header, sizeof(header)))
+    {
+        std::cout << "Failed to write trajectory " << path << ": " << strerror(errno) << std::endl;
+        close(recorder.file);
+        recorder.file = -1; // so the destructor does not close it again
+        return false;
+    }
+    recorder.offset = sizeof(header);
+
+    for (TrajectorySlot &slot : recorder.slots)
+    {
+        slot.x.assign(numCircles, 0);
+        slot.y.assign(numCircles, 0);
+    }
+    recorder.previousX.assign(numCircles, 0);
+    recorder.previousY.assign(numCircles, 0);
+
+    recorder.running = true;
+    recorder.thread = std::thread(runTrajectoryWriter, std::ref(recorder));
+    return true;
+}
+
+// write the frames still queued, then the keyframe index, and close the file
+inline void stopTrajectoryRecorder(TrajectoryRecorder &recorder)
+{
+    if (recorder.file < 0)
+    {
+        return;
+    }
+    recorder.running.store(false, std::memory_order_release);
+    recorder.thread.join();
+
+    TrajectoryTrailer trailer = {};
+    trailer.indexOffset = recorder.offset;
+    trailer.frames = recorder.frames;
+    trailer.keyframes = (int64_t)recorder.keyframes.size();
+    memcpy(trailer.magic, trajectoryIndexMagic, sizeof(trailer.magic));
+    bool written = !recorder.failed &&
+                   writeFully(recorder.file, recorder.keyframes.data(),
+                              sizeof(TrajectoryKeyframe) * recorder.keyframes.size()) &&
+                   writeFully(recorder.file, &trailer, sizeof(trailer));
+    written = close(recorder.file) == 0 && written;
+    recorder.file = -1;
+
+    if (!written)
+    {
+        std::cout << "Failed to write trajectory " << recorder.path << std::endl;
+        return;
+    }
+    std::cout << "Recorded " << recorder.frames << " frames (" << recorder.dropped << " dropped, "
+              << recorder.offset / (1024.0 * 1024.0) << " MB) to " << recorder.path << std::endl;
+}
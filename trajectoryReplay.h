@@ -0,0 +1,221 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "particleStore.h"
+#include "sceneLoader.h"
+#include "trajectory.h"
+
+// Trajectory replay
+// -----------------
+// Plays back a file written by the trajectory recorder without simulating.
+// The file is mapped, and frames are decoded straight from the mapping into
+// the quantized positions of the current frame and then into the particle
+// arrays, one recorded frame per displayed frame. Seeking to any frame starts
+// decoding at the last keyframe before it, so it never costs more than
+// keyframeInterval frames. Opening a file only reads its keyframe index, so
+// pages are touched as frames are played. Recordings that were cut short have
+// no index; it is then rebuilt by walking the frame headers.
+
+struct TrajectoryReplay
+{
+    MappedFile file;
+    TrajectoryHeader header;
+    std::vector<TrajectoryKeyframe> keyframes;
+    long long frames = 0;
+    uint64_t framesEnd = 0; // where the last frame ends
+
+    long long frame = -1; // frame held in x and y, -1 before the first
+    long long step = 0;   // step it was recorded at
+    uint64_t offset = 0;  // of the frame after it
+    std::vector<int32_t> x;
+    std::vector<int32_t> y;
+};
+
+inline bool openTrajectory(TrajectoryReplay &replay, const std::string &path)
+{
+    if (!mapFile(replay.file, path))
+    {
+        return false;
+    }
+    const MappedFile &file = replay.file;
+    if (file.bytes >= sizeof(TrajectoryHeader))
+    {
+        memcpy(&replay.header, file.data, sizeof(TrajectoryHeader));
+    }
+    const TrajectoryHeader &header = replay.header;
+    if (file.bytes < sizeof(TrajectoryHeader) || memcmp(header.magic, trajectoryMagic, sizeof(header.magic)) != 0 ||
+        header.version != trajectoryVersion || header.headerBytes != sizeof(TrajectoryHeader) || header.count <= 0 ||
+        header.keyframeInterval <= 0 || !(header.scale > 0.0f))
+    {
+        std::cout << "Trajectory " << path << " is not a version " << trajectoryVersion << " trajectory" << std::endl;
+        return false;
+    }
+
+    // the index at the end, when the recording was closed properly
+    TrajectoryTrailer trailer;
+    bool indexed = false;
+    if (file.bytes >= sizeof(TrajectoryHeader) + sizeof(trailer))
+    {
+        memcpy(&trailer, file.data + file.bytes - sizeof(trailer), sizeof(trailer));
+        indexed = memcmp(trailer.magic, trajectoryIndexMagic, sizeof(trailer.magic)) == 0 && trailer.frames > 0 &&
+                  trailer.keyframes > 0 && trailer.keyframes <= int64_t(file.bytes / sizeof(TrajectoryKeyframe)) &&
+                  trailer.indexOffset >= sizeof(TrajectoryHeader) &&
+                  trailer.indexOffset + sizeof(TrajectoryKeyframe) * trailer.keyframes + sizeof(trailer) == file.bytes;
+    }
+    if (indexed)
+    {
+        const char *index = file.data + trailer.indexOffset;
+        replay.keyframes.resize(trailer.keyframes);
+        memcpy(replay.keyframes.data(), index, sizeof(TrajectoryKeyframe) * trailer.keyframes);
+        replay.frames = trailer.frames;
+        replay.framesEnd = trailer.indexOffset;
+    }
+    else
+    {
+        // walk the frame headers up to the last complete frame
+        uint64_t offset = sizeof(TrajectoryHeader);
+        while (offset + sizeof(TrajectoryFrameHeader) <= file.bytes)
+        {
+            TrajectoryFrameHeader frameHeader;
+            memcpy(&frameHeader, file.data + offset, sizeof(frameHeader));
+            uint64_t next = offset + sizeof(frameHeader) + frameHeader.bytes;
+            if (next > file.bytes || (replay.frames == 0 && !frameHeader.keyframe))
+            {
+                break;
+            }
+            if (frameHeader.keyframe)
+            {
+                replay.keyframes.push_back({replay.frames, frameHeader.step, offset});
+            }
+            replay.frames++;
+            offset = next;
+        }
+        replay.framesEnd = offset;
+    }
+    if (replay.frames == 0 || replay.keyframes.empty() || replay.keyframes.front().frame != 0)
+    {
+        std::cout << "Trajectory " << path << " has no frames" << std::endl;
+        return false;
+    }
+
+    replay.x.assign(header.count, 0);
+    replay.y.assign(header.count, 0);
+    return true;
+}
+
+// decode the frame after the current one into x and y
+inline bool decodeNextFrame(TrajectoryReplay &replay)
+{
+    TrajectoryFrameHeader frameHeader;
+    bool valid = replay.frame + 1 < replay.frames && replay.offset + sizeof(frameHeader) <= replay.framesEnd;
+    if (valid)
+    {
+        memcpy(&frameHeader, replay.file.data + replay.offset, sizeof(frameHeader));
+        valid = replay.offset + sizeof(frameHeader) + frameHeader.bytes <= replay.framesEnd;
+    }
+
+    const uint8_t *in = (const uint8_t *)replay.file.data + replay.offset + sizeof(frameHeader);
+    const uint8_t *end = valid ? in + frameHeader.bytes : in;
+    int32_t *x = replay.x.data();
+    int32_t *y = replay.y.data();
+    for (int circle = 0; valid && circle < replay.header.count; circle++)
+    {
+        int32_t dx, dy;
+        if (!decodeVarint(in, end, dx) || !decodeVarint(in, end, dy))
+        {
+            valid = false;
+            break;
+        }
+        x[circle] = frameHeader.keyframe ? dx : x[circle] + dx;
+        y[circle] = frameHeader.keyframe ? dy : y[circle] + dy;
+    }
+    if (!valid)
+    {
+        // x and y are partly overwritten, the next seek starts again at a keyframe
+        std::cout << "Trajectory frame " << replay.frame + 1 << " is corrupt" << std::endl;
+        replay.frame = -1;
+        return false;
+    }
+
+    replay.frame++;
+    replay.step = frameHeader.step;
+    replay.offset = end - (const uint8_t *)replay.file.data;
+    return true;
+}
+
+// make frame the current one, decoding from the nearest keyframe unless it is just ahead
+inline bool seekTrajectory(TrajectoryReplay &replay, long long frame)
+{
+    frame = std::min(std::max(frame, 0ll), replay.frames - 1);
+    std::vector<TrajectoryKeyframe>::const_iterator keyframe =
+        std::upper_bound(replay.keyframes.begin(), replay.keyframes.end(), frame,
+                         [](long long frame, const TrajectoryKeyframe &keyframe) { return frame < keyframe.frame; }) -
+        1;
+    if (frame < replay.frame || keyframe->frame > replay.frame)
+    {
+        replay.frame = keyframe->frame - 1;
+        replay.offset = keyframe->offset;
+    }
+    while (replay.frame < frame)
+    {
+        if (!decodeNextFrame(replay))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// show frame in particles (by stable id), wrapping around at the ends
+inline bool showTrajectoryFrame(TrajectoryReplay &replay, ParticleStore &particles, long long frame)
+{
+    frame %= replay.frames;
+    if (!seekTrajectory(replay, frame < 0 ? frame + replay.frames : frame))
+    {
+        return false;
+    }
+
+    float unit = 1.0f / replay.header.scale;
+    const int32_t *x = replay.x.data();
+    const int32_t *y = replay.y.data();
+#pragma omp parallel for schedule(static)
+    for (int circle = 0; circle < particles.count; circle++)
+    {
+        particles.x[circle] = float(x[circle]) * unit;
+        particles.y[circle] = float(y[circle]) * unit;
+    }
+    return true;
+}
+
+// decode every frame from first on without a window and report the throughput
+inline void runReplayHeadless(TrajectoryReplay &replay, ParticleStore &particles, long long first)
+{
+    first = std::min(std::max(first, 0ll), replay.frames - 1);
+
+    long long firstStep = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (long long frame = first; frame < replay.frames; frame++)
+    {
+        if (!showTrajectoryFrame(replay, particles, frame))
+        {
+            return;
+        }
+        if (frame == first)
+        {
+            firstStep = replay.step;
+        }
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    long long frames = replay.frames - first;
+    std::cout << "Circles: " << particles.count << "\n"
+              << "Frames: " << frames << " (steps " << firstStep << " to " << replay.step << ")\n"
+              << "Total time: " << elapsed.count() << " s\n"
+              << "Frames/s: " << frames / elapsed.count() << std::endl;
+}